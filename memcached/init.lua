@@ -5,6 +5,8 @@ local socket = require('socket')
 local errno  = require('errno')
 local uri    = require('uri')
 local log    = require('log')
+local fiber  = require('fiber')
+local net_box = require('net.box')
 
 local fmt = string.format
 
@@ -50,6 +52,34 @@ struct memcached_stat {
     /* authentication stats */
     uint64_t      auth_cmds;
     uint64_t      auth_errors;
+    /* read only replica stats */
+    uint64_t      read_only_rejects;
+    uint64_t      proxy_forwarded;
+    uint64_t      proxy_errors;
+    uint64_t      proxy_hot_reads;
+    uint64_t      proxy_hot_copies;
+    uint64_t      vbucket_rejects;
+    uint64_t      set_unchanged;
+    uint64_t      set_coalesced;
+    uint64_t      async_errors;
+    uint64_t      tenant_evictions;
+    uint64_t      throttled;
+    uint64_t      throttled_usec;
+    uint64_t      shed_busy;
+    uint64_t      shed_dropped;
+    uint64_t      loop_lag_usec;
+    uint64_t      priority_yields;
+    uint64_t      expire_pace;
+    uint64_t      expire_speedups;
+    uint64_t      expire_backoffs;
+    uint64_t      expire_sampled;
+    uint64_t      admission_accesses;
+    uint64_t      admission_admitted;
+    uint64_t      admission_rejected;
+    uint64_t      sliding_touches;
+    uint64_t      scratch_bytes;
+    uint64_t      scratch_peak;
+    uint64_t      set_inplace;
 };
 
 void
@@ -71,6 +101,30 @@ enum memcached_options {
     MEMCACHED_OPT_VERBOSITY      = 0x05,
     MEMCACHED_OPT_PROTOCOL       = 0x06,
     MEMCACHED_OPT_SASL           = 0x07,
+    MEMCACHED_OPT_READ_ONLY      = 0x08,
+    MEMCACHED_OPT_MASTER         = 0x09,
+    MEMCACHED_OPT_PROXY          = 0x0A,
+    MEMCACHED_OPT_PROXY_CONNS    = 0x0B,
+    MEMCACHED_OPT_PROXY_TIMEOUT  = 0x0C,
+    MEMCACHED_OPT_HOT_REPLICAS   = 0x0D,
+    MEMCACHED_OPT_HOT_THRESHOLD  = 0x0E,
+    MEMCACHED_OPT_HOT_TTL        = 0x0F,
+    MEMCACHED_OPT_VBUCKETS       = 0x10,
+    MEMCACHED_OPT_COALESCE       = 0x11,
+    MEMCACHED_OPT_ASYNC_WRITERS  = 0x12,
+    MEMCACHED_OPT_ASYNC_QUEUE    = 0x13,
+    MEMCACHED_OPT_CONN_OPS       = 0x14,
+    MEMCACHED_OPT_CONN_BYTES     = 0x15,
+    MEMCACHED_OPT_USER_OPS       = 0x16,
+    MEMCACHED_OPT_USER_BYTES     = 0x17,
+    MEMCACHED_OPT_SHED_LAG       = 0x18,
+    MEMCACHED_OPT_SHED_DELAY     = 0x19,
+    MEMCACHED_OPT_PRIORITY       = 0x1A,
+    MEMCACHED_OPT_EXPIRE_ADAPTIVE = 0x1B,
+    MEMCACHED_OPT_EXPIRE_STRATEGY = 0x1C,
+    MEMCACHED_OPT_ADMISSION      = 0x1D,
+    MEMCACHED_OPT_EVICTION       = 0x1E,
+    MEMCACHED_OPT_SLIDING_FLAG   = 0x1F,
     MEMCACHED_OPT_MAX
 };
 
@@ -84,6 +138,45 @@ int    memcached_start     (struct memcached_service *);
 void   memcached_stop      (struct memcached_service *);
 void   memcached_free      (struct memcached_service *);
 void   memcached_handler   (struct memcached_service *p, int fd);
+int    memcached_purge     (struct memcached_service *);
+int    memcached_sync      (struct memcached_service *);
+void   memcached_cas_observe(struct memcached_service *, uint64_t cas);
+uint64_t memcached_flush_time(struct memcached_service *);
+int    memcached_set_partitions(struct memcached_service *, uint32_t count,
+                                uint32_t tenants, const uint32_t *space_ids);
+uint32_t memcached_space_of(struct memcached_service *, const char *key,
+                            uint32_t key_len);
+int    memcached_set_tenant(struct memcached_service *, uint32_t i,
+                            const char *name, const char *prefix,
+                            uint64_t quota, uint64_t bytes);
+int    memcached_set_user_priority(struct memcached_service *,
+                                   const char *name, const char *priority);
+void   memcached_clear_user_priorities(struct memcached_service *);
+
+enum memcached_dump_format {
+    MEMCACHED_DUMP_BINARY = 0x00,
+    MEMCACHED_DUMP_TEXT   = 0x01,
+    MEMCACHED_DUMP_MAX
+};
+
+ssize_t
+memcached_dump_import(struct memcached_service *p, const char *path,
+                      enum memcached_dump_format format, int batch);
+ssize_t
+memcached_dump_export(struct memcached_service *p, const char *path,
+                      enum memcached_dump_format format);
+
+enum memcached_vbucket_state {
+    MEMCACHED_VBUCKET_DEAD   = 0x00,
+    MEMCACHED_VBUCKET_ACTIVE = 0x01,
+    MEMCACHED_VBUCKET_MAX
+};
+
+int    memcached_vbucket_set(struct memcached_service *p, uint32_t vb,
+                             enum memcached_vbucket_state state);
+int    memcached_vbucket_get(struct memcached_service *p, uint32_t vb);
+uint32_t memcached_vbucket_of(struct memcached_service *p, const char *key,
+                              uint32_t key_len);
 int    memcached_setsockopt(int fd, const char *family, const char *type);
 ]]
 
@@ -128,6 +221,18 @@ local typetable = {
         function(x) return x > 0 end,
         [[time required for full index scan (in seconds)]]
     },
+    expire_adaptive = {
+        'boolean',
+        function() return true end,
+        function(x) return true end,
+        [[adapt pace of expiration to expired items and event loop lag]]
+    },
+    expire_strategy = {
+        'string',
+        function() return 'scan' end,
+        function(x) return x == 'scan' or x == 'sample' end,
+        [[expiration by full scans ('scan') or random samples ('sample')]]
+    },
     verbosity = {
         'number',
         function() return 0 end,
@@ -174,6 +279,176 @@ local typetable = {
                    x == 'disk'
         end,
         [[storage type ('memory' for RAM, 'disk' for HDD/SSD)]]
+    },
+    read_only = {
+        'boolean',
+        function() return false end,
+        function(x) return true end,
+        [[serve only reads, reject writes with reference to master]]
+    },
+    master = {
+        'string',
+        function() return nil end,
+        function(x) local a = uri.parse(x); return (a and a['service']) end,
+        [[uri of master, reported to clients, that send writes to replica]]
+    },
+    proxy = {
+        'string',
+        function() return nil end,
+        function(x) return x:match('[^,%s]+:%d+') ~= nil end,
+        [[comma separated 'host:port' list of backends to route requests to]]
+    },
+    proxy_connections = {
+        'number',
+        function() return 4 end,
+        function(x) return x > 0 and x < 1024 end,
+        [[count of connections to every backend]]
+    },
+    proxy_timeout = {
+        'number',
+        function() return 1 end,
+        function(x) return x > 0 end,
+        [[time to wait for backend response (in seconds)]]
+    },
+    proxy_hot_replicas = {
+        'number',
+        function() return 0 end,
+        function(x) return x >= 0 end,
+        [[count of backends, that hold copies of hot key (0 to disable)]]
+    },
+    proxy_hot_threshold = {
+        'number',
+        function() return 10000 end,
+        function(x) return x > 0 end,
+        [[reads per second, that make key hot]]
+    },
+    proxy_hot_ttl = {
+        'number',
+        function() return 2 end,
+        function(x) return x > 0 end,
+        [[TTL of hot key copies (in seconds)]]
+    },
+    vbuckets = {
+        'number',
+        function() return 0 end,
+        function(x) return x >= 0 and x <= 0x8000 end,
+        [[count of vbuckets (0 to disable)]]
+    },
+    partitions = {
+        'number',
+        function() return 1 end,
+        function(x) return x >= 1 and x <= 0x8000 end,
+        [[count of spaces, the key space is split into]]
+    },
+    coalesce_window = {
+        'number',
+        function() return 0 end,
+        function(x) return x >= 0 end,
+        [[time, sets are buffered for, before write to space (0 to disable)]]
+    },
+    async_writers = {
+        'number',
+        function() return 0 end,
+        function(x) return x >= 0 and x <= 64 end,
+        [[count of fibers, that write quiet sets (0 to wait for WAL)]]
+    },
+    async_queue = {
+        'number',
+        function() return 65536 end,
+        function(x) return x > 0 end,
+        [[count of pending quiet sets, connections wait at]]
+    },
+    tenants = {
+        'table',
+        function() return {} end,
+        function(x)
+            for name, tenant in pairs(x) do
+                if type(name) ~= 'string' or type(tenant) ~= 'table' or
+                   type(tenant.prefix) ~= 'string' or #tenant.prefix == 0 or
+                   (tenant.quota ~= nil and (type(tenant.quota) ~= 'number' or
+                                             tenant.quota < 0)) then
+                    return false
+                end
+            end
+            return true
+        end,
+        [[{name = {prefix = 'key prefix', quota = bytes}} spaces of tenants]]
+    },
+    admission = {
+        'string',
+        function() return 'off' end,
+        function(x)
+            return x == 'off' or x == 'not_stored' or x == 'accept'
+        end,
+        [[new items to full tenants ('off'/'not_stored'/'accept' rejected)]]
+    },
+    eviction = {
+        'string',
+        function() return 'random' end,
+        function(x) return x == 'random' or x == 'gdsf' end,
+        [[eviction policy of tenants over quota ('random'/'gdsf')]]
+    },
+    sliding_flag = {
+        'number',
+        function() return 0 end,
+        function(x) return x >= 0 and x < 2^32 and math.floor(x) == x end,
+        [[flags bit of items, that live for TTL since the last read]]
+    },
+    conn_ops_limit = {
+        'number',
+        function() return 0 end,
+        function(x) return x >= 0 end,
+        [[requests per second of a connection (0 is unlimited)]]
+    },
+    conn_bytes_limit = {
+        'number',
+        function() return 0 end,
+        function(x) return x >= 0 end,
+        [[request bytes per second of a connection (0 is unlimited)]]
+    },
+    user_ops_limit = {
+        'number',
+        function() return 0 end,
+        function(x) return x >= 0 end,
+        [[requests per second of a SASL user (0 is unlimited)]]
+    },
+    user_bytes_limit = {
+        'number',
+        function() return 0 end,
+        function(x) return x >= 0 end,
+        [[request bytes per second of a SASL user (0 is unlimited)]]
+    },
+    shed_lag = {
+        'number',
+        function() return 0 end,
+        function(x) return x >= 0 end,
+        [[event loop lag (seconds) to shed requests above (0 is off)]]
+    },
+    shed_delay = {
+        'number',
+        function() return 0 end,
+        function(x) return x >= 0 end,
+        [[queueing delay (seconds) to shed requests above (0 is off)]]
+    },
+    priority = {
+        'string',
+        function() return 'normal' end,
+        function(x) return x == 'low' or x == 'normal' or x == 'high' end,
+        [[priority class of connections ('low'/'normal'/'high')]]
+    },
+    user_priority = {
+        'table',
+        function() return {} end,
+        function(x)
+            for name, prio in pairs(x) do
+                if type(name) ~= 'string' or (prio ~= 'low' and
+                   prio ~= 'normal' and prio ~= 'high') then
+                    return false
+                end
+            end
+            return true
+        end,
+        [[{user = 'low'/'normal'/'high'} priority classes of SASL users]]
     }
 --    flush_enabled = {
 --        'boolean',
@@ -190,6 +465,18 @@ local err_bad_value       = "Bad value for argument '%s'"
 local err_bad_instance    = "Instance with name '%s' is already created"
 local err_is_stopped      = "Memcached instance '%s' is already stopped"
 local err_is_started      = "Memcached instance '%s' is already started"
+local err_box_configured  = "Recovery filter must be set before box.cfg{}"
+local err_no_schema_init  = "Recovery filter requires box.ctl.on_schema_init"
+local err_bad_format      = "Bad dump format '%s', expected 'binary' or 'text'"
+local err_bad_vbucket     = "Bad vbucket %s for instance '%s'"
+local err_bad_vb_state    = "Bad vbucket state '%s', expected 'active' or 'dead'"
+local err_migrate_state   = "Vbucket %d of instance '%s' isn't active"
+local err_bad_partition   = "Bad partition %s for instance '%s'"
+local err_migrate_connect = "Can't connect to migration target '%s': %s"
+local err_warmup_connect  = "Can't connect to warmup source '%s': %s"
+local err_proxy_running   = "Can't change backends of running instance '%s'"
+local err_start_fibers    = "Can't start fibers of instance '%s'"
+local err_create_only     = "Option '%s' of instance '%s' can be set only on creation"
 
 local function config_check(cfg)
     for k, v in pairs(cfg) do
@@ -239,21 +526,333 @@ local stat_table = {
     'cmd_touch', 'touch_hits', 'touch_misses',
     'cmd_flush',
     'evictions', 'reclaimed',
-    'auth_cmds', 'auth_errors'
+    'auth_cmds', 'auth_errors',
+    'read_only_rejects',
+    'proxy_forwarded', 'proxy_errors',
+    'proxy_hot_reads', 'proxy_hot_copies',
+    'vbucket_rejects',
+    'set_unchanged', 'set_coalesced',
+    'async_errors', 'tenant_evictions',
+    'throttled', 'throttled_usec',
+    'shed_busy', 'shed_dropped', 'loop_lag_usec',
+    'priority_yields',
+    'expire_pace', 'expire_speedups', 'expire_backoffs',
+    'expire_sampled',
+    'admission_accesses', 'admission_admitted', 'admission_rejected',
+    'sliding_touches',
+    'scratch_bytes', 'scratch_peak',
+    'set_inplace'
 }
 
 local C = ffi.C
 
+local dump_formats = {
+    binary = C.MEMCACHED_DUMP_BINARY,
+    text   = C.MEMCACHED_DUMP_TEXT,
+}
+
+local vbucket_states = {
+    [C.MEMCACHED_VBUCKET_DEAD]   = 'dead',
+    [C.MEMCACHED_VBUCKET_ACTIVE] = 'active',
+    dead   = C.MEMCACHED_VBUCKET_DEAD,
+    active = C.MEMCACHED_VBUCKET_ACTIVE,
+}
+
 local conf_table = {
     readahead             = C.MEMCACHED_OPT_READAHEAD,
     expire_enabled        = C.MEMCACHED_OPT_EXPIRE_ENABLED,
     expire_items_per_iter = C.MEMCACHED_OPT_EXPIRE_COUNT,
     expire_full_scan_time = C.MEMCACHED_OPT_EXPIRE_TIME,
+    expire_adaptive       = C.MEMCACHED_OPT_EXPIRE_ADAPTIVE,
+    expire_strategy       = C.MEMCACHED_OPT_EXPIRE_STRATEGY,
     verbosity             = C.MEMCACHED_OPT_VERBOSITY,
     protocol              = C.MEMCACHED_OPT_PROTOCOL,
-    sasl                  = C.MEMCACHED_OPT_SASL
+    sasl                  = C.MEMCACHED_OPT_SASL,
+    read_only             = C.MEMCACHED_OPT_READ_ONLY,
+    master                = C.MEMCACHED_OPT_MASTER,
+    proxy                 = C.MEMCACHED_OPT_PROXY,
+    proxy_connections     = C.MEMCACHED_OPT_PROXY_CONNS,
+    proxy_timeout         = C.MEMCACHED_OPT_PROXY_TIMEOUT,
+    proxy_hot_replicas    = C.MEMCACHED_OPT_HOT_REPLICAS,
+    proxy_hot_threshold   = C.MEMCACHED_OPT_HOT_THRESHOLD,
+    proxy_hot_ttl         = C.MEMCACHED_OPT_HOT_TTL,
+    vbuckets              = C.MEMCACHED_OPT_VBUCKETS,
+    coalesce_window       = C.MEMCACHED_OPT_COALESCE,
+    async_writers         = C.MEMCACHED_OPT_ASYNC_WRITERS,
+    async_queue           = C.MEMCACHED_OPT_ASYNC_QUEUE,
+    conn_ops_limit        = C.MEMCACHED_OPT_CONN_OPS,
+    conn_bytes_limit      = C.MEMCACHED_OPT_CONN_BYTES,
+    user_ops_limit        = C.MEMCACHED_OPT_USER_OPS,
+    user_bytes_limit      = C.MEMCACHED_OPT_USER_BYTES,
+    shed_lag              = C.MEMCACHED_OPT_SHED_LAG,
+    shed_delay            = C.MEMCACHED_OPT_SHED_DELAY,
+    priority              = C.MEMCACHED_OPT_PRIORITY,
+    admission             = C.MEMCACHED_OPT_ADMISSION,
+    eviction              = C.MEMCACHED_OPT_EVICTION,
+    sliding_flag          = C.MEMCACHED_OPT_SLIDING_FLAG
 }
 
+-- Space of the partition, the key belongs to
+local function space_of(instance, key)
+    if #instance.spaces == 1 then
+        return instance.space
+    end
+    return box.space[C.memcached_space_of(instance.service, key, #key)]
+end
+
+-- Iterate over tuples of every partition
+local function partitions_pairs(instance)
+    local i, gen, param, state = 0, nil, nil, nil
+    return function()
+        while true do
+            if gen ~= nil then
+                local tuple
+                state, tuple = gen(param, state)
+                if tuple ~= nil then
+                    return true, tuple
+                end
+            end
+            i = i + 1
+            local space = instance.spaces[i]
+            if space == nil then
+                return nil
+            end
+            gen, param, state = space:pairs()
+        end
+    end
+end
+
+-- Tuples, scanned for max CAS on promotion between yields
+local CAS_SCAN_BATCH = 1000
+
+-- Replica keeps its CAS counter above the values, assigned by master,
+-- so CAS is still unique when the replica is promoted. Promotion yields
+-- during the scan, it's called while writes are still rejected.
+local function cas_observer_set(instance, enable)
+    local service = instance.service
+    if enable and instance.cas_observer == nil then
+        instance.cas_observer = function(old, new)
+            if new ~= nil then
+                C.memcached_cas_observe(service, new[5])
+            end
+        end
+        for _, space in ipairs(instance.spaces) do
+            space:on_replace(instance.cas_observer)
+        end
+    elseif not enable and instance.cas_observer ~= nil then
+        -- tuples, recovered before the trigger was set, weren't seen,
+        -- the trigger sees tuples, replicated during the scan
+        local scanned = 0
+        for _, tuple in partitions_pairs(instance) do
+            C.memcached_cas_observe(service, tuple[5])
+            scanned = scanned + 1
+            if scanned % CAS_SCAN_BATCH == 0 then
+                fiber.sleep(0)
+            end
+        end
+        for _, space in ipairs(instance.spaces) do
+            space:on_replace(nil, instance.cas_observer)
+        end
+        instance.cas_observer = nil
+    end
+end
+
+-- Same as is_expired_tuple()
+local function tuple_is_expired(tuple, now, flush)
+    return tuple[2] <= now or (flush <= now and tuple[3] <= flush)
+end
+
+-- Warmup cursors of the source, one per session of the warming node
+local warmup_cursors = nil
+
+local function warmup_cursors_init()
+    if warmup_cursors ~= nil then
+        return
+    end
+    warmup_cursors = {}
+    box.session.on_disconnect(function()
+        warmup_cursors[box.session.id()] = nil
+    end)
+end
+
+-- Source side of warmup: next 'limit' tuples of the space, only live
+-- ones, that were written at or after 'since', are returned
+local function warmup_page(instance, limit, since, restart)
+    warmup_cursors_init()
+    local sid = box.session.id()
+    local cursor = warmup_cursors[sid]
+    if restart or cursor == nil then
+        cursor = { iter = partitions_pairs(instance) }
+        warmup_cursors[sid] = cursor
+    end
+    local now   = fiber.time64()
+    local flush = C.memcached_flush_time(instance.service)
+    local items = {}
+    local done  = false
+    for _ = 1, limit do
+        local _, tuple = cursor.iter()
+        if tuple == nil then
+            warmup_cursors[sid] = nil
+            done = true
+            break
+        end
+        if not tuple_is_expired(tuple, now, flush) and tuple[3] >= since then
+            table.insert(items, tuple)
+        end
+    end
+    return { now = now, done = done, items = items }
+end
+
+-- Warming side: one pass over the source, returns source time of the
+-- pass start and count of copied items
+local function warmup_pass(instance, conn, name, since, opts)
+    local expr = "local name, limit, since, restart = ... " ..
+                 "return require('memcached').get(name)" ..
+                 ":warmup_page(limit, since, restart)"
+    local start, count, restart = nil, 0, true
+    while true do
+        local page = conn:eval(expr, { name, opts.page, since, restart })
+        restart = false
+        start = start or page.now
+        box.begin()
+        local ok, err = pcall(function()
+            for _, tuple in ipairs(page.items) do
+                space_of(instance, tuple[1]):replace(tuple)
+                C.memcached_cas_observe(instance.service, tuple[5])
+            end
+        end)
+        if not ok then
+            box.rollback()
+            error(err)
+        end
+        box.commit()
+        count = count + #page.items
+        if page.done then
+            break
+        end
+        -- throttle, so the source keeps serving its clients
+        fiber.sleep(opts.delay)
+    end
+    return start, count
+end
+
+-- Receiving side of migration: apply a page of changes of a vbucket
+local function migrate_apply(instance, items, deletes)
+    box.begin()
+    local ok, err = pcall(function()
+        for _, tuple in ipairs(items) do
+            space_of(instance, tuple[1]):replace(tuple)
+            C.memcached_cas_observe(instance.service, tuple[5])
+        end
+        for _, key in ipairs(deletes) do
+            space_of(instance, key):delete{key}
+        end
+    end)
+    if not ok then
+        box.rollback()
+        error(err)
+    end
+    box.commit()
+    return #items + #deletes
+end
+
+local migrate_apply_expr = "local name, items, deletes = ... " ..
+                           "return require('memcached').get(name)" ..
+                           ":migrate_apply(items, deletes)"
+
+-- Send current state of dirty keys: live items are replaced on target,
+-- the rest are deleted. Returns count of sent keys.
+local function migrate_catchup(instance, conn, name, dirty, opts)
+    local now   = fiber.time64()
+    local flush = C.memcached_flush_time(instance.service)
+    local items, deletes, count = {}, {}, 0
+    for key in pairs(dirty) do
+        local tuple = space_of(instance, key):get{key}
+        if tuple ~= nil and not tuple_is_expired(tuple, now, flush) then
+            table.insert(items, tuple)
+        else
+            table.insert(deletes, key)
+        end
+        count = count + 1
+        if #items + #deletes >= opts.page then
+            conn:eval(migrate_apply_expr, { name, items, deletes })
+            items, deletes = {}, {}
+        end
+    end
+    if #items + #deletes > 0 then
+        conn:eval(migrate_apply_expr, { name, items, deletes })
+    end
+    return count
+end
+
+-- Copy every live item of the vbucket, returns count of copied items
+local function migrate_copy(instance, conn, name, vb, opts)
+    local service = instance.service
+    local flush   = C.memcached_flush_time(service)
+    local items, count, scanned = {}, 0, 0
+    for _, tuple in partitions_pairs(instance) do
+        local key = tuple[1]
+        if C.memcached_vbucket_of(service, key, #key) == vb and
+           not tuple_is_expired(tuple, fiber.time64(), flush) then
+            table.insert(items, tuple)
+        end
+        scanned = scanned + 1
+        if #items >= opts.page or scanned % opts.page == 0 then
+            if #items > 0 then
+                conn:eval(migrate_apply_expr, { name, items, {} })
+                count = count + #items
+                items = {}
+            end
+            -- throttle, so the source keeps serving its clients
+            fiber.sleep(opts.delay)
+        end
+    end
+    if #items > 0 then
+        conn:eval(migrate_apply_expr, { name, items, {} })
+        count = count + #items
+    end
+    return count
+end
+
+local function migrate_purge(instance, vb, opts)
+    local service = instance.service
+    -- vbucket has its own partition, when counts are equal
+    if instance.opts.partitions == instance.opts.vbuckets and
+       next(instance.opts.tenants) == nil then
+        instance.spaces[vb + 1]:truncate()
+        return
+    end
+    local keys = {}
+    for _, tuple in partitions_pairs(instance) do
+        local key = tuple[1]
+        if C.memcached_vbucket_of(service, key, #key) == vb then
+            table.insert(keys, key)
+        end
+    end
+    for i, key in ipairs(keys) do
+        space_of(instance, key):delete{key}
+        if i % opts.page == 0 then
+            fiber.sleep(opts.delay)
+        end
+    end
+end
+
+local function tenants_equal(a, b)
+    for name, tenant in pairs(a) do
+        local other = b[name]
+        if other == nil or other.prefix ~= tenant.prefix or
+           (other.quota or 0) ~= (tenant.quota or 0) then
+            return false
+        end
+    end
+    for name in pairs(b) do
+        if a[name] == nil then
+            return false
+        end
+    end
+    return true
+end
+
 local memcached_methods = {
     cfg = function (self, opts)
         if type(opts) ~= 'table' then
@@ -263,12 +862,45 @@ local memcached_methods = {
         if stat == false then
             error(err)
         end
+        -- spaces of partitions and tenants are set up on creation
+        if self.status ~= nil then
+            if opts.partitions ~= nil and
+               opts.partitions ~= self.opts.partitions then
+                error(fmt(err_create_only, 'partitions', self.name))
+            end
+            if opts.tenants ~= nil and
+               not tenants_equal(opts.tenants, self.opts.tenants) then
+                error(fmt(err_create_only, 'tenants', self.name))
+            end
+        end
+        if opts.proxy ~= nil then
+            if self.status == RUNNING then
+                error(fmt(err_proxy_running, self.name))
+            end
+            -- other proxy options are applied to created proxy
+            C.memcached_set_opt(self.service, conf_table.proxy, opts.proxy)
+            self.opts.proxy = opts.proxy
+        end
+        -- before the option, so promoted replica writes after the scan
+        if opts.read_only ~= nil then
+            cas_observer_set(self, opts.read_only)
+        end
         for k, v in pairs(opts) do
-            if conf_table[k] ~= nil then
+            if conf_table[k] ~= nil and k ~= 'proxy' then
                 C.memcached_set_opt(self.service, conf_table[k], v)
                 self.opts[k] = v
             end
         end
+        if opts.user_priority ~= nil then
+            C.memcached_clear_user_priorities(self.service)
+            for user, prio in pairs(opts.user_priority) do
+                if C.memcached_set_user_priority(self.service, user,
+                                                 prio) == -1 then
+                    error(fmt(err_enomem, "user priority"))
+                end
+            end
+            self.opts.user_priority = opts.user_priority
+        end
         return self
     end,
     start = function (self)
@@ -281,7 +913,11 @@ local memcached_methods = {
         if self.status == RUNNING then
             error(fmt(err_is_started, self.name))
         end
-        C.memcached_start(self.service)
+        if C.memcached_start(self.service) == -1 then
+            C.memcached_stop(self.service)
+            self.status = ERRORED
+            error(fmt(err_start_fibers, self.name))
+        end
         local parsed = uri.parse(self.uri)
         self.listener = socket.tcp_server(parsed.host, parsed.service, {
             handler = memcached_handler
@@ -320,10 +956,275 @@ local memcached_methods = {
         return retval
     end,
     grant = function (self, username)
-        box.schema.user.grant(username, 'read,write', 'space', self.space_name)
+        for _, space in ipairs(self.spaces) do
+            box.schema.user.grant(username, 'read,write', 'space', space.name)
+        end
+        return self
+    end,
+    -- Drop every item of a partition
+    flush_partition = function (self, part)
+        local space = self.spaces[part + 1]
+        if space == nil then
+            error(fmt(err_bad_partition, tostring(part), self.name))
+        end
+        space:truncate()
+        return self
+    end,
+    purge = function (self)
+        if C.memcached_purge(self.service) == -1 then
+            box.error()
+        end
+        return self
+    end,
+    import = function (self, path, format, opts)
+        opts = opts or {}
+        local fmt_id = dump_formats[format or 'binary']
+        if fmt_id == nil then
+            error(fmt(err_bad_format, tostring(format)))
+        end
+        local count = C.memcached_dump_import(self.service, path, fmt_id,
+                                              opts.batch or 0)
+        if count == -1 then
+            box.error()
+        end
+        return tonumber(count)
+    end,
+    export = function (self, path, format)
+        local fmt_id = dump_formats[format or 'binary']
+        if fmt_id == nil then
+            error(fmt(err_bad_format, tostring(format)))
+        end
+        local count = C.memcached_dump_export(self.service, path, fmt_id)
+        if count == -1 then
+            box.error()
+        end
+        return tonumber(count)
+    end,
+    -- Copy live items from 'source' (uri of a node with the same
+    -- memcached instance). The first pass copies everything, next passes
+    -- copy only items, written since the start of the previous pass.
+    -- Deletes, made during the warmup, aren't caught up.
+    warmup = function (self, source, opts)
+        opts = opts or {}
+        local name = opts.name or self.name
+        local conf = {
+            page   = opts.page   or 1000,
+            delay  = opts.delay  or 0.001,
+            passes = opts.passes or 3
+        }
+        local conn = net_box.connect(source)
+        if not conn:is_connected() then
+            error(fmt(err_warmup_connect, source, tostring(conn.error)))
+        end
+        local since, total = 0, 0
+        for pass = 1, conf.passes do
+            local start, count = warmup_pass(self, conn, name, since, conf)
+            log.info("memcached '%s' warmup pass %d: %d items from '%s'",
+                     self.name, pass, count, source)
+            total = total + count
+            since = start
+            -- nothing more than a page changed, we caught up
+            if pass > 1 and count < conf.page then
+                break
+            end
+        end
+        conn:close()
+        return total
+    end,
+    warmup_page = warmup_page,
+    -- Get or set state of vbucket. Requests for keys of 'dead' vbuckets
+    -- are rejected with 'not my vbucket' error.
+    vbucket = function (self, vb, state)
+        if state == nil then
+            local rc = C.memcached_vbucket_get(self.service, vb)
+            if rc == -1 then
+                error(fmt(err_bad_vbucket, tostring(vb), self.name))
+            end
+            return vbucket_states[rc]
+        end
+        if type(state) ~= 'string' or vbucket_states[state] == nil then
+            error(fmt(err_bad_vb_state, tostring(state)))
+        end
+        if C.memcached_vbucket_set(self.service, vb,
+                                   vbucket_states[state]) == -1 then
+            error(fmt(err_bad_vbucket, tostring(vb), self.name))
+        end
         return self
+    end,
+    -- Move vbucket to the same instance on 'target' node (uri), where the
+    -- vbucket must be dead. Items are copied, while the vbucket is served
+    -- here, keys changed meanwhile are tracked and sent again. Then the
+    -- vbucket is marked dead here, the rest of changes is sent and the
+    -- vbucket is activated on target.
+    migrate = function (self, vb, target, opts)
+        opts = opts or {}
+        local name = opts.name or self.name
+        local conf = {
+            page   = opts.page   or 1000,
+            delay  = opts.delay  or 0.001,
+            passes = opts.passes or 5,
+        }
+        if self:vbucket(vb) ~= 'active' then
+            error(fmt(err_migrate_state, vb, self.name))
+        end
+        local conn = net_box.connect(target)
+        if not conn:is_connected() then
+            error(fmt(err_migrate_connect, target, tostring(conn.error)))
+        end
+        local service = self.service
+        local dirty = {}
+        local function tracker(old, new)
+            local key = (new or old)[1]
+            if C.memcached_vbucket_of(service, key, #key) == vb then
+                dirty[key] = true
+            end
+        end
+        for _, space in ipairs(self.spaces) do
+            space:on_replace(tracker)
+        end
+        local flipped = false
+        local ok, rv = pcall(function()
+            local count = migrate_copy(self, conn, name, vb, conf)
+            for _ = 1, conf.passes do
+                local changes = dirty
+                dirty = {}
+                local sent = migrate_catchup(self, conn, name, changes, conf)
+                -- few changes are left, the flip will be short
+                if sent < conf.page then
+                    break
+                end
+            end
+            -- writes of the vbucket are rejected from now on
+            self:vbucket(vb, 'dead')
+            flipped = true
+            -- buffered sets of the vbucket are seen by the tracker
+            if C.memcached_sync(service) == -1 then
+                box.error()
+            end
+            while next(dirty) ~= nil do
+                local changes = dirty
+                dirty = {}
+                migrate_catchup(self, conn, name, changes, conf)
+            end
+            conn:eval("local name, vb = ... " ..
+                      "require('memcached').get(name):vbucket(vb, 'active')",
+                      { name, vb })
+            return count
+        end)
+        for _, space in ipairs(self.spaces) do
+            space:on_replace(nil, tracker)
+        end
+        conn:close()
+        if not ok then
+            if flipped then
+                self:vbucket(vb, 'active')
+            end
+            error(rv)
+        end
+        log.info("memcached '%s' vbucket %d is migrated to '%s', %d items",
+                 self.name, vb, target, rv)
+        if opts.purge ~= false then
+            migrate_purge(self, vb, conf)
+        end
+        return rv
+    end,
+    migrate_apply = migrate_apply,
+    vbucket_of = function (self, key)
+        if self.opts.vbuckets == 0 then
+            return nil
+        end
+        return tonumber(C.memcached_vbucket_of(self.service, key, #key))
     end
 }
+jit.off(memcached_methods.purge)
+jit.off(memcached_methods.import)
+jit.off(memcached_methods.export)
+
+-- Skip tuples, that are already expired, while memtx recovers them from
+-- snapshot/xlog. Semantics is the same as in is_expired_tuple(): tuple is
+-- dropped when its 'expire' field (usec) is in the past. An expired
+-- replacement removes the older value too, it was overwritten by client.
+local function recovery_filter(old, new)
+    if new ~= nil and new[2] <= fiber.time64() then
+        return nil
+    end
+    return new
+end
+
+local recovery_spaces = nil
+
+local function is_recovery_space(name)
+    if recovery_spaces == nil then
+        return startswith(name, '__mc_')
+    end
+    return recovery_spaces[name] ~= nil
+end
+
+local function memcached_skip_expired(spaces)
+    if type(box.cfg) ~= 'function' then
+        error(err_box_configured)
+    end
+    if box.ctl == nil or box.ctl.on_schema_init == nil then
+        error(err_no_schema_init)
+    end
+    if spaces ~= nil then
+        recovery_spaces = {}
+        for _, name in pairs(spaces) do recovery_spaces[name] = true end
+    end
+    box.ctl.on_schema_init(function()
+        box.space._space:on_replace(function(old_space, new_space)
+            if old_space ~= nil or new_space == nil or
+               not is_recovery_space(new_space[3]) then
+                return
+            end
+            local space_name = new_space[3]
+            box.on_commit(function()
+                box.space[space_name]:before_replace(recovery_filter)
+            end)
+        end)
+    end)
+end
+
+local function recovery_filter_drop(space)
+    if space.before_replace == nil then
+        return
+    end
+    for _, trigger in pairs(space:before_replace()) do
+        if trigger == recovery_filter then
+            space:before_replace(nil, recovery_filter)
+        end
+    end
+end
+
+-- Delete expired items of every instance and make a checkpoint, so
+-- the snapshot doesn't carry them.
+local function memcached_snapshot()
+    for _, instance in pairs(memcached_services) do
+        instance:purge()
+    end
+    return box.snapshot()
+end
+
+local function memcached_space_create(space_name, conf)
+    local storage = startswith(conf.storage, 'mem') and 'memtx' or 'vinyl'
+    local index   = startswith(conf.storage, 'mem') and 'hash' or nil
+    local space = box.schema.create_space(space_name, {
+        engine = storage,
+        format = {
+            { name = 'key',      type = 'str' },
+            { name = 'expire',   type = 'num' },
+            { name = 'creation', type = 'num' },
+            { name = 'value',    type = 'str' },
+            { name = 'cas',      type = 'num' },
+            { name = 'flags',    type = 'num' },
+        }
+    })
+    space:create_index('primary', {
+        parts = {1, 'str'},
+        type = index
+    })
+    return space
+end
 
 local function memcached_init(name, uri, opts)
     opts = opts or {}
@@ -339,32 +1240,68 @@ local function memcached_init(name, uri, opts)
     instance.name = name
     instance.uri  = uri
     instance.space_name = opts.space_name or '__mc_' .. instance.name
-    if box.space[instance.space_name] == nil then
-        local storage = startswith(conf.storage, 'mem') and 'memtx' or 'vinyl'
-        local index   = startswith(conf.storage, 'mem') and 'hash' or nil
-        instance.space = box.schema.create_space(instance.space_name, {
-            engine = storage,
-            format = {
-                { name = 'key',      type = 'str' },
-                { name = 'expire',   type = 'num' },
-                { name = 'creation', type = 'num' },
-                { name = 'value',    type = 'str' },
-                { name = 'cas',      type = 'num' },
-                { name = 'flags',    type = 'num' },
-            }
-        })
-        instance.space:create_index('primary', {
-            parts = {1, 'str'},
-            type = index
-        })
-    else
-        instance.space = box.space[instance.space_name]
+    -- the first partition is stored in the space with the instance's
+    -- space name, others get suffix with number of partition
+    instance.spaces = {}
+    for part = 0, conf.partitions - 1 do
+        local space_name = instance.space_name
+        if part > 0 then
+            space_name = space_name .. '_' .. part
+        end
+        local space = box.space[space_name]
+        if space == nil then
+            space = memcached_space_create(space_name, conf)
+        else
+            -- recovery is over, no need to filter writes anymore
+            recovery_filter_drop(space)
+        end
+        table.insert(instance.spaces, space)
+    end
+    -- every tenant is stored in its own space with tenant's name suffix,
+    -- prefixes are matched from the longest one
+    local tenants = {}
+    for tenant_name, tenant in pairs(conf.tenants) do
+        local space_name = instance.space_name .. '_' .. tenant_name
+        local space = box.space[space_name]
+        if space == nil then
+            space = memcached_space_create(space_name, conf)
+        else
+            recovery_filter_drop(space)
+        end
+        table.insert(tenants, { name = tenant_name, prefix = tenant.prefix,
+                                quota = tenant.quota or 0, space = space })
     end
+    table.sort(tenants, function(a, b)
+        if #a.prefix ~= #b.prefix then
+            return #a.prefix > #b.prefix
+        end
+        return a.name < b.name
+    end)
+    instance.space = instance.spaces[1]
     local service = C.memcached_create(instance.name, instance.space.id)
     if service == nil then
         error(fmt(err_enomem, "memcached service"))
     end
     instance.service = ffi.gc(service, C.memcached_free)
+    for _, tenant in ipairs(tenants) do
+        table.insert(instance.spaces, tenant.space)
+    end
+    if #instance.spaces > 1 then
+        local ids = ffi.new('uint32_t[?]', #instance.spaces)
+        for i, space in ipairs(instance.spaces) do
+            ids[i - 1] = space.id
+        end
+        if C.memcached_set_partitions(service, conf.partitions, #tenants,
+                                      ids) == -1 then
+            error(fmt(err_enomem, "memcached partitions"))
+        end
+    end
+    for i, tenant in ipairs(tenants) do
+        if C.memcached_set_tenant(service, i - 1, tenant.name, tenant.prefix,
+                                  tenant.quota, tenant.space:bsize()) == -1 then
+            error(fmt(err_enomem, "memcached tenant"))
+        end
+    end
     memcached_services[instance.name] = setmetatable(instance, {
         __index = memcached_methods
     })
@@ -376,9 +1313,11 @@ local function memcached_get(name)
 end
 
 return {
-    create = memcached_init,
-    get    = memcached_get,
-    server = setmetatable({}, {
+    create   = memcached_init,
+    get      = memcached_get,
+    snapshot = memcached_snapshot,
+    skip_expired_on_recovery = memcached_skip_expired,
+    server   = setmetatable({}, {
         __index = memcached_services
     })
 }
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <tarantool/module.h>
+
+#include "utils.h"
+#include "admission.h"
+
+/**
+ * TinyLFU admission: accesses of keys are counted by a count-min sketch
+ * of 4-bit counters, and the first access of a key only sets its bits in
+ * the doorkeeper bloom filter, so one-hit wonders don't take counters.
+ * After every sample of accesses counters are halved and the doorkeeper
+ * is cleared, so the frequency is recent. A new item is admitted, only
+ * if its key is accessed more often, than the key of the victim.
+ * The same estimation is the frequency of GDSF eviction.
+ */
+
+#define ADMISSION_ROWS    4
+#define ADMISSION_WIDTH   16384
+#define ADMISSION_DOOR    (ADMISSION_WIDTH * 8)
+#define ADMISSION_SAMPLE  (ADMISSION_WIDTH * 10)
+#define ADMISSION_CNT_MAX 15
+
+struct memcached_admission {
+	uint32_t samples;
+	uint8_t  sketch[ADMISSION_ROWS][ADMISSION_WIDTH];
+	uint64_t door[ADMISSION_DOOR / 64];
+};
+
+struct memcached_admission *
+memcached_admission_new()
+{
+	struct memcached_admission *a = (struct memcached_admission *)
+		calloc(1, sizeof(struct memcached_admission));
+	if (a == NULL)
+		say_syserror("failed to allocate memory for admission sketch");
+	return a;
+}
+
+void
+memcached_admission_delete(struct memcached_admission *a)
+{
+	free(a);
+}
+
+/* Double hashing: i-th index is h1 + i * h2 */
+static inline void
+admission_hash(const char *key, uint32_t key_len, uint32_t *h1, uint32_t *h2)
+{
+	*h1 = memcached_crc32(key, key_len);
+	*h2 = (uint32_t )(((uint64_t )*h1 * 0x9E3779B97F4A7C15ULL) >> 32) | 1;
+}
+
+static inline bool
+admission_door_test(struct memcached_admission *a, uint32_t h1, uint32_t h2)
+{
+	uint32_t b1 = h1 % ADMISSION_DOOR, b2 = (h1 + h2) % ADMISSION_DOOR;
+	return (a->door[b1 / 64] & (1ULL << (b1 % 64))) &&
+	       (a->door[b2 / 64] & (1ULL << (b2 % 64)));
+}
+
+static inline void
+admission_door_set(struct memcached_admission *a, uint32_t h1, uint32_t h2)
+{
+	uint32_t b1 = h1 % ADMISSION_DOOR, b2 = (h1 + h2) % ADMISSION_DOOR;
+	a->door[b1 / 64] |= (1ULL << (b1 % 64));
+	a->door[b2 / 64] |= (1ULL << (b2 % 64));
+}
+
+static void
+admission_reset(struct memcached_admission *a)
+{
+	for (int r = 0; r < ADMISSION_ROWS; ++r) {
+		for (int i = 0; i < ADMISSION_WIDTH; ++i)
+			a->sketch[r][i] >>= 1;
+	}
+	memset(a->door, 0, sizeof(a->door));
+	a->samples = 0;
+}
+
+void
+memcached_admission_record(struct memcached_admission *a,
+			   const char *key, uint32_t key_len)
+{
+	uint32_t h1, h2;
+	admission_hash(key, key_len, &h1, &h2);
+	if (!admission_door_test(a, h1, h2)) {
+		admission_door_set(a, h1, h2);
+	} else {
+		for (int r = 0; r < ADMISSION_ROWS; ++r) {
+			uint8_t *cnt = &a->sketch[r][(h1 + r * h2) %
+						     ADMISSION_WIDTH];
+			if (*cnt < ADMISSION_CNT_MAX)
+				(*cnt)++;
+		}
+	}
+	if (++a->samples >= ADMISSION_SAMPLE)
+		admission_reset(a);
+}
+
+uint32_t
+memcached_admission_estimate(struct memcached_admission *a,
+			     const char *key, uint32_t key_len)
+{
+	uint32_t h1, h2;
+	admission_hash(key, key_len, &h1, &h2);
+	uint32_t est = ADMISSION_CNT_MAX;
+	for (int r = 0; r < ADMISSION_ROWS; ++r) {
+		uint8_t cnt = a->sketch[r][(h1 + r * h2) % ADMISSION_WIDTH];
+		if (cnt < est)
+			est = cnt;
+	}
+	return est + (admission_door_test(a, h1, h2) ? 1 : 0);
+}
+
+bool
+memcached_admission_admit(struct memcached_admission *a,
+			  const char *key, uint32_t key_len,
+			  const char *victim, uint32_t victim_len)
+{
+	return memcached_admission_estimate(a, key, key_len) >
+	       memcached_admission_estimate(a, victim, victim_len);
+}
@@ -0,0 +1,35 @@
+#ifndef   ADMISSION_H_INCLUDED
+#define   ADMISSION_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct memcached_admission;
+
+/* What to do with a set, that isn't admitted */
+enum memcached_admission_mode {
+	MEMCACHED_ADMISSION_OFF        = 0x00,
+	MEMCACHED_ADMISSION_NOT_STORED = 0x01,
+	MEMCACHED_ADMISSION_ACCEPT     = 0x02
+};
+
+struct memcached_admission *
+memcached_admission_new();
+
+void
+memcached_admission_delete(struct memcached_admission *a);
+
+void
+memcached_admission_record(struct memcached_admission *a,
+			   const char *key, uint32_t key_len);
+
+uint32_t
+memcached_admission_estimate(struct memcached_admission *a,
+			     const char *key, uint32_t key_len);
+
+bool
+memcached_admission_admit(struct memcached_admission *a,
+			  const char *key, uint32_t key_len,
+			  const char *victim, uint32_t victim_len);
+
+#endif /* ADMISSION_H_INCLUDED */
@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <tarantool/module.h>
+#include <msgpuck.h>
+#include <small/mempool.h>
+
+#include "memcached.h"
+#include "error.h"
+#include "utils.h"
+#include "coalesce.h"
+
+/**
+ * Write coalescing: sets are kept in memory for 'window' seconds and
+ * only the last value of every key goes to the space (and the WAL).
+ * Gets of the instance look into the buffer first.
+ *
+ * Asynchronous writes: quiet sets are put into the same buffer and
+ * written by a pool of writer fibers, so the connection doesn't wait
+ * for the WAL. Connections wait, when 'limit' sets are pending.
+ */
+
+#define COALESCE_BUCKETS   4096
+/* flush fiber is woken up early, when so many keys are pending */
+#define COALESCE_HIGH      65536
+/* count of tuples, written in one transaction */
+#define COALESCE_BATCH     256
+/* sleep of the flush fiber, while coalescing is disabled */
+#define COALESCE_IDLE      1.0
+#define COALESCE_WRITERS_MAX 64
+
+struct coalesce_entry {
+	struct coalesce_entry *next;
+	uint32_t               hash;
+	uint32_t               space_id;
+	box_tuple_t           *tuple;
+};
+
+struct memcached_coalesce {
+	double                 window;
+	uint32_t               count;
+	/* count of batches, that are being written */
+	uint32_t               inflight;
+	struct mempool         pool;
+	struct fiber          *fiber;
+	const char            *name;
+	struct memcached_stat *stat;
+	/* asynchronous writes */
+	int                    writer_count;
+	uint32_t               limit;
+	struct fiber          *writers[COALESCE_WRITERS_MAX];
+	struct fiber_cond     *pending;
+	struct fiber_cond     *drained;
+	struct coalesce_entry *buckets[COALESCE_BUCKETS];
+};
+
+struct memcached_coalesce *
+memcached_coalesce_new(struct memcached_stat *stat)
+{
+	struct memcached_coalesce *c = (struct memcached_coalesce *)
+		calloc(1, sizeof(struct memcached_coalesce));
+	if (c == NULL) {
+		say_syserror("failed to allocate memory for coalesce buffer");
+		return NULL;
+	}
+	c->pending = fiber_cond_new();
+	c->drained = fiber_cond_new();
+	if (c->pending == NULL || c->drained == NULL) {
+		say_error("Can't create condition for coalesce buffer");
+		if (c->pending) fiber_cond_delete(c->pending);
+		if (c->drained) fiber_cond_delete(c->drained);
+		free(c);
+		return NULL;
+	}
+	mempool_create(&c->pool, cord_slab_cache(),
+		       sizeof(struct coalesce_entry));
+	c->stat  = stat;
+	c->limit = COALESCE_HIGH;
+	return c;
+}
+
+static inline void
+coalesce_entry_free(struct memcached_coalesce *c, struct coalesce_entry *e)
+{
+	box_tuple_unref(e->tuple);
+	mempool_free(&c->pool, e);
+}
+
+/* Buffer must be flushed before, pending writes are dropped */
+void
+memcached_coalesce_delete(struct memcached_coalesce *c)
+{
+	if (c == NULL)
+		return;
+	for (int i = 0; i < COALESCE_BUCKETS; ++i) {
+		while (c->buckets[i] != NULL) {
+			struct coalesce_entry *e = c->buckets[i];
+			c->buckets[i] = e->next;
+			coalesce_entry_free(c, e);
+		}
+	}
+	mempool_destroy(&c->pool);
+	fiber_cond_delete(c->pending);
+	fiber_cond_delete(c->drained);
+	free(c);
+}
+
+/* Zero window disables coalescing, pending writes are flushed */
+void
+memcached_coalesce_set_window(struct memcached_coalesce *c, double window)
+{
+	c->window = window;
+	if (c->fiber != NULL)
+		fiber_wakeup(c->fiber);
+}
+
+bool
+memcached_coalesce_enabled(struct memcached_coalesce *c)
+{
+	return c != NULL && c->window > 0;
+}
+
+bool
+memcached_coalesce_async(struct memcached_coalesce *c)
+{
+	return c != NULL && c->writer_count > 0;
+}
+
+static inline bool
+coalesce_entry_is(struct coalesce_entry *e, uint32_t hash, const char *key,
+		  uint32_t key_len)
+{
+	if (e->hash != hash)
+		return false;
+	uint32_t len = 0;
+	const char *pos = box_tuple_field(e->tuple, 0);
+	const char *ekey = mp_decode_str(&pos, &len);
+	return len == key_len && memcmp(ekey, key, key_len) == 0;
+}
+
+static struct coalesce_entry **
+coalesce_find(struct memcached_coalesce *c, const char *key, uint32_t key_len,
+	      uint32_t *hashp)
+{
+	uint32_t hash = memcached_crc32(key, key_len);
+	struct coalesce_entry **ep = &c->buckets[hash % COALESCE_BUCKETS];
+	for (; *ep != NULL; ep = &(*ep)->next) {
+		if (coalesce_entry_is(*ep, hash, key, key_len))
+			break;
+	}
+	if (hashp != NULL)
+		*hashp = hash;
+	return ep;
+}
+
+/**
+ * Buffer the tuple instead of writing it to the space. Previous
+ * pending value of the key is replaced and never reaches the WAL.
+ */
+int
+memcached_coalesce_put(struct memcached_coalesce *c, uint32_t space_id,
+		       const char *key, uint32_t key_len,
+		       const char *tuple, const char *tuple_end)
+{
+	box_tuple_t *tpl = box_tuple_new(box_tuple_format_default(), tuple,
+					 tuple_end);
+	if (tpl == NULL)
+		return -1;
+	uint32_t hash = 0;
+	struct coalesce_entry **ep = coalesce_find(c, key, key_len, &hash);
+	struct coalesce_entry *e = *ep;
+	if (e != NULL) {
+		box_tuple_unref(e->tuple);
+		c->stat->set_coalesced++;
+	} else {
+		e = (struct coalesce_entry *)mempool_alloc(&c->pool);
+		if (e == NULL) {
+			memcached_error_ENOMEM(sizeof(struct coalesce_entry),
+					       "coalesce entry");
+			return -1;
+		}
+		e->next = NULL;
+		e->hash = hash;
+		*ep = e;
+		if (++c->count == COALESCE_HIGH && c->fiber != NULL)
+			fiber_wakeup(c->fiber);
+	}
+	box_tuple_ref(tpl);
+	e->tuple    = tpl;
+	e->space_id = space_id;
+	if (c->writer_count > 0)
+		fiber_cond_signal(c->pending);
+	return 0;
+}
+
+/**
+ * Forget pending set of the key, it's overwritten by a set, that is
+ * written to the space at once.
+ */
+void
+memcached_coalesce_drop(struct memcached_coalesce *c, const char *key,
+			uint32_t key_len)
+{
+	if (c == NULL || c->count == 0)
+		return;
+	struct coalesce_entry **ep = coalesce_find(c, key, key_len, NULL);
+	struct coalesce_entry *e = *ep;
+	if (e == NULL)
+		return;
+	*ep = e->next;
+	c->count--;
+	coalesce_entry_free(c, e);
+}
+
+/* Wait, while too many asynchronous writes are pending */
+void
+memcached_coalesce_throttle(struct memcached_coalesce *c)
+{
+	while (c != NULL && c->writer_count > 0 && c->count >= c->limit)
+		fiber_cond_wait(c->drained);
+}
+
+/* Pending tuple of the key or NULL */
+box_tuple_t *
+memcached_coalesce_get(struct memcached_coalesce *c, const char *key,
+		       uint32_t key_len)
+{
+	if (c == NULL || c->count == 0)
+		return NULL;
+	struct coalesce_entry *e = *coalesce_find(c, key, key_len, NULL);
+	return e != NULL ? e->tuple : NULL;
+}
+
+static inline int
+coalesce_replace(struct coalesce_entry *e)
+{
+	size_t size = box_tuple_bsize(e->tuple);
+	char *begin = (char *)box_txn_alloc(size);
+	if (begin == NULL) {
+		memcached_error_ENOMEM(size, "tuple");
+		return -1;
+	}
+	box_tuple_to_buf(e->tuple, begin, size);
+	return box_replace(e->space_id, begin, begin + size, NULL);
+}
+
+/**
+ * Write pending tuple of the key to the space in the current
+ * transaction, used before the key is deleted.
+ */
+int
+memcached_coalesce_write(struct memcached_coalesce *c, const char *key,
+			 uint32_t key_len)
+{
+	if (c == NULL || c->count == 0)
+		return 0;
+	struct coalesce_entry **ep = coalesce_find(c, key, key_len, NULL);
+	struct coalesce_entry *e = *ep;
+	if (e == NULL)
+		return 0;
+	int rc = coalesce_replace(e);
+	*ep = e->next;
+	c->count--;
+	coalesce_entry_free(c, e);
+	return rc;
+}
+
+/* Unlink up to COALESCE_BATCH pending entries */
+static struct coalesce_entry *
+coalesce_take(struct memcached_coalesce *c)
+{
+	struct coalesce_entry *batch = NULL;
+	int taken = 0;
+	for (int i = 0; i < COALESCE_BUCKETS && taken < COALESCE_BATCH; ++i) {
+		while (c->buckets[i] != NULL && taken < COALESCE_BATCH) {
+			struct coalesce_entry *e = c->buckets[i];
+			c->buckets[i] = e->next;
+			e->next = batch;
+			batch = e;
+			c->count--;
+			taken++;
+		}
+	}
+	return batch;
+}
+
+/**
+ * Write a batch in one transaction. Entries are unlinked before
+ * commit, so sets, that come during the commit, are buffered again and
+ * written by the next batch. Lost sets are counted in stats.
+ */
+static int
+coalesce_write_batch(struct memcached_coalesce *c,
+		     struct coalesce_entry *batch)
+{
+	int rc = 0, size = 0;
+	c->inflight++;
+	if (box_txn_begin() == -1) {
+		rc = -1;
+	} else {
+		struct coalesce_entry *e = batch;
+		for (; e != NULL && rc == 0; e = e->next)
+			rc = coalesce_replace(e);
+		if (rc == 0)
+			rc = box_txn_commit();
+		else
+			box_txn_rollback();
+	}
+	while (batch != NULL) {
+		struct coalesce_entry *e = batch;
+		batch = e->next;
+		coalesce_entry_free(c, e);
+		size++;
+	}
+	if (rc == -1)
+		c->stat->async_errors += size;
+	c->inflight--;
+	fiber_cond_broadcast(c->drained);
+	return rc;
+}
+
+/* Write every pending tuple to its space, including batches of writers */
+int
+memcached_coalesce_flush(struct memcached_coalesce *c)
+{
+	if (c == NULL)
+		return 0;
+	int rc = 0;
+	while (c->count > 0) {
+		if (coalesce_write_batch(c, coalesce_take(c)) == -1)
+			rc = -1;
+	}
+	while (c->inflight > 0)
+		fiber_cond_wait(c->drained);
+	return rc;
+}
+
+static void
+coalesce_log_error(void)
+{
+	const box_error_t *err = box_error_last();
+	say_error("Can't write coalesced items: %s", box_error_message(err));
+}
+
+static int
+memcached_coalesce_loop(va_list ap)
+{
+	struct memcached_coalesce *c = va_arg(ap, struct memcached_coalesce *);
+	fiber_set_cancellable(true);
+	while (!fiber_is_cancelled()) {
+		fiber_sleep(c->window > 0 ? c->window : COALESCE_IDLE);
+		fiber_set_cancellable(false);
+		if (memcached_coalesce_flush(c) == -1)
+			coalesce_log_error();
+		fiber_set_cancellable(true);
+	}
+	return 0;
+}
+
+/* Writer of asynchronous sets: writes a batch, as soon as it's there */
+static int
+memcached_coalesce_writer(va_list ap)
+{
+	struct memcached_coalesce *c = va_arg(ap, struct memcached_coalesce *);
+	fiber_set_cancellable(true);
+	while (!fiber_is_cancelled()) {
+		if (c->count == 0) {
+			fiber_cond_wait(c->pending);
+			continue;
+		}
+		fiber_set_cancellable(false);
+		if (coalesce_write_batch(c, coalesce_take(c)) == -1)
+			coalesce_log_error();
+		fiber_set_cancellable(true);
+	}
+	return 0;
+}
+
+static void
+coalesce_writers_stop(struct memcached_coalesce *c)
+{
+	for (int i = 0; i < COALESCE_WRITERS_MAX; ++i) {
+		if (c->writers[i] == NULL)
+			continue;
+		fiber_cancel(c->writers[i]);
+		fiber_join(c->writers[i]);
+		c->writers[i] = NULL;
+	}
+}
+
+static int
+coalesce_writers_start(struct memcached_coalesce *c)
+{
+	for (int i = 0; i < c->writer_count; ++i) {
+		if (c->writers[i] != NULL)
+			continue;
+		char fname[128];
+		snprintf(fname, 128, "__mc_%s_writer_%d", c->name, i);
+		c->writers[i] = fiber_new(fname, memcached_coalesce_writer);
+		if (c->writers[i] == NULL) {
+			say_error("Can't start the writer fiber");
+			return -1;
+		}
+		fiber_set_joinable(c->writers[i], true);
+		fiber_start(c->writers[i], c);
+	}
+	return 0;
+}
+
+/**
+ * Quiet sets are written by 'writers' fibers (0 disables asynchronous
+ * writes), connections wait, when 'limit' sets are pending.
+ */
+int
+memcached_coalesce_set_async(struct memcached_coalesce *c, int writers,
+			     uint32_t limit)
+{
+	if (limit > 0)
+		c->limit = limit;
+	if (writers < 0)
+		return 0;
+	if (writers > COALESCE_WRITERS_MAX)
+		writers = COALESCE_WRITERS_MAX;
+	bool running = (c->fiber != NULL);
+	coalesce_writers_stop(c);
+	c->writer_count = writers;
+	fiber_cond_broadcast(c->drained);
+	if (running)
+		return coalesce_writers_start(c);
+	return 0;
+}
+
+int
+memcached_coalesce_start(struct memcached_coalesce *c, const char *name)
+{
+	if (c == NULL || c->fiber != NULL)
+		return 0;
+	c->name = name;
+	char fname[128];
+	snprintf(fname, 128, "__mc_%s_coalesce", name);
+	c->fiber = fiber_new(fname, memcached_coalesce_loop);
+	if (c->fiber == NULL) {
+		say_error("Can't start the coalesce fiber");
+		return -1;
+	}
+	fiber_set_joinable(c->fiber, true);
+	fiber_start(c->fiber, c);
+	return coalesce_writers_start(c);
+}
+
+/* Stop the fibers and write out everything, that is pending */
+void
+memcached_coalesce_stop(struct memcached_coalesce *c)
+{
+	if (c == NULL || c->fiber == NULL)
+		return;
+	coalesce_writers_stop(c);
+	fiber_cancel(c->fiber);
+	fiber_join(c->fiber);
+	c->fiber = NULL;
+	if (memcached_coalesce_flush(c) == -1)
+		coalesce_log_error();
+}
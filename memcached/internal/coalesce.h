@@ -0,0 +1,58 @@
+#ifndef   COALESCE_H_INCLUDED
+#define   COALESCE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct memcached_coalesce;
+struct memcached_stat;
+
+struct memcached_coalesce *
+memcached_coalesce_new(struct memcached_stat *stat);
+
+void
+memcached_coalesce_delete(struct memcached_coalesce *c);
+
+void
+memcached_coalesce_set_window(struct memcached_coalesce *c, double window);
+
+bool
+memcached_coalesce_enabled(struct memcached_coalesce *c);
+
+bool
+memcached_coalesce_async(struct memcached_coalesce *c);
+
+int
+memcached_coalesce_set_async(struct memcached_coalesce *c, int writers,
+			     uint32_t limit);
+
+void
+memcached_coalesce_throttle(struct memcached_coalesce *c);
+
+int
+memcached_coalesce_start(struct memcached_coalesce *c, const char *name);
+
+void
+memcached_coalesce_stop(struct memcached_coalesce *c);
+
+int
+memcached_coalesce_put(struct memcached_coalesce *c, uint32_t space_id,
+		       const char *key, uint32_t key_len,
+		       const char *tuple, const char *tuple_end);
+
+box_tuple_t *
+memcached_coalesce_get(struct memcached_coalesce *c, const char *key,
+		       uint32_t key_len);
+
+void
+memcached_coalesce_drop(struct memcached_coalesce *c, const char *key,
+			uint32_t key_len);
+
+int
+memcached_coalesce_write(struct memcached_coalesce *c, const char *key,
+			 uint32_t key_len);
+
+int
+memcached_coalesce_flush(struct memcached_coalesce *c);
+
+#endif /* COALESCE_H_INCLUDED */
@@ -0,0 +1,504 @@
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include <tarantool/module.h>
+#include <msgpuck.h>
+#include <small/ibuf.h>
+
+#include "memcached.h"
+#include "memcached_layer.h"
+#include "constants.h"
+#include "error.h"
+#include "proto_txt_parser.h"
+#include "dump.h"
+
+/* size of a single read from the dump file */
+#define MEMCACHED_DUMP_CHUNK (1 << 20)
+/* default count of items, inserted in one transaction */
+#define MEMCACHED_DUMP_BATCH 1000
+/* count of items, sent by 'stats dump' between flushes */
+#define MEMCACHED_DUMP_STAT_BATCH 1000
+
+struct dump_import {
+	/* pseudo connection, used for text parser and tuple setters */
+	struct memcached_connection con;
+	int     batch;
+	int     in_batch;
+	ssize_t count;
+	ssize_t skipped;
+};
+
+/* Executed in coio thread */
+static ssize_t
+dump_read_cb(va_list ap)
+{
+	int fd     = va_arg(ap, int);
+	char *buf  = va_arg(ap, char *);
+	size_t len = va_arg(ap, size_t);
+	ssize_t n  = 0;
+	do {
+		n = read(fd, buf, len);
+	} while (n == -1 && errno == EINTR);
+	return n;
+}
+
+static inline int
+dump_import_commit(struct dump_import *imp)
+{
+	imp->in_batch = 0;
+	memcached_scratch_reset(&imp->con);
+	if (box_txn() && box_txn_commit() == -1)
+		return -1;
+	return 0;
+}
+
+static inline int
+dump_import_item(struct dump_import *imp, const char *key, uint32_t klen,
+		 const char *val, uint32_t vlen, uint32_t flags,
+		 uint64_t exptime)
+{
+	/* Don't waste memory on items nobody can read */
+	if (exptime <= fiber_time64()) {
+		imp->skipped++;
+		return 0;
+	}
+	if (!box_txn() && box_txn_begin() == -1)
+		return -1;
+	struct memcached_service *p = imp->con.cfg;
+	if (memcached_tuple_set(&imp->con, key, klen, exptime, val, vlen,
+				p->cas++, flags) == -1) {
+		box_txn_rollback();
+		return -1;
+	}
+	imp->count++;
+	if (++imp->in_batch >= imp->batch)
+		return dump_import_commit(imp);
+	return 0;
+}
+
+/**
+ * Process every complete record in the buffer, the tail is left
+ * for the next read.
+ */
+static int
+dump_import_binary(struct dump_import *imp, struct ibuf *buf)
+{
+	const size_t hlen = sizeof(struct memcached_dump_rec);
+	while (ibuf_used(buf) >= hlen) {
+		const struct memcached_dump_rec *rec =
+			(const struct memcached_dump_rec *)buf->rpos;
+		uint16_t klen = mp_bswap_u16(rec->key_len);
+		uint32_t vlen = mp_bswap_u32(rec->val_len);
+		if (klen == 0 || vlen > MEMCACHED_MAX_SIZE) {
+			memcached_error_SERVER_ERROR("Bad record in dump: key "
+						     "length %" PRIu16 ", value "
+						     "length %" PRIu32,
+						     klen, vlen);
+			return -1;
+		}
+		if (ibuf_used(buf) < hlen + klen + vlen)
+			break;
+		const char *key = buf->rpos + hlen;
+		const char *val = key + klen;
+		uint32_t flags  = mp_bswap_u32(rec->flags);
+		uint64_t exptime = convert_exptime(mp_bswap_u32(rec->expire));
+		if (dump_import_item(imp, key, klen, val, vlen, flags,
+				     exptime) == -1)
+			return -1;
+		buf->rpos += hlen + klen + vlen;
+	}
+	return 0;
+}
+
+/**
+ * Text dump is a sequence of memcached storage commands, for example
+ * an output of `memcached-tool <host> dump`. It's parsed with the text
+ * protocol parser, every command is imported as 'set'.
+ */
+static int
+dump_import_text(struct dump_import *imp, struct ibuf *buf)
+{
+	struct memcached_connection *con = &imp->con;
+	struct memcached_txt_request *req = &con->request;
+	while (ibuf_used(buf) > 0) {
+		const char *pos = buf->rpos;
+		int rc = memcached_txt_parser(con, &pos, buf->wpos);
+		if (rc > 0) {
+			/* need more data */
+			break;
+		} else if (rc == -1) {
+			if (box_error_last() == NULL)
+				memcached_error_EINVALS("bad command line format");
+			return -1;
+		}
+		switch (req->op) {
+		case MEMCACHED_TXT_CMD_SET:
+		case MEMCACHED_TXT_CMD_ADD:
+		case MEMCACHED_TXT_CMD_REPLACE:
+		case MEMCACHED_TXT_CMD_CAS:
+			break;
+		default:
+			memcached_error_SERVER_ERROR("Unexpected command '%s' "
+						     "in dump",
+						     memcached_txt_cmdname(req->op));
+			return -1;
+		}
+		uint64_t exptime = convert_exptime(req->exptime);
+		if (dump_import_item(imp, req->key, req->key_len, req->data,
+				     req->data_len, req->flags, exptime) == -1)
+			return -1;
+		buf->rpos = (char *)pos;
+	}
+	return 0;
+}
+
+/**
+ * Import items from dump file in 'format'. File is read by big chunks
+ * in coio thread, items are inserted in transactions of 'batch' items.
+ *
+ * \returns count of imported items or -1 on error
+ */
+ssize_t
+memcached_dump_import(struct memcached_service *p, const char *path,
+		      enum memcached_dump_format format, int batch)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		memcached_error_SERVER_ERROR("Can't open '%s' for reading: %s",
+					     path, strerror(errno));
+		return -1;
+	}
+
+	struct dump_import imp;
+	memset(&imp, 0, sizeof(struct dump_import));
+	imp.con.cfg = p;
+	imp.batch   = (batch > 0 ? batch : MEMCACHED_DUMP_BATCH);
+	region_create(&imp.con.scratch, cord_slab_cache());
+
+	struct ibuf buf;
+	ibuf_create(&buf, cord_slab_cache(), MEMCACHED_DUMP_CHUNK);
+
+	ssize_t rc  = -1;
+	bool eof    = false;
+	bool header = (format != MEMCACHED_DUMP_BINARY);
+	box_error_clear();
+	while (!eof) {
+		if (ibuf_reserve(&buf, MEMCACHED_DUMP_CHUNK) == NULL) {
+			memcached_error_ENOMEM(MEMCACHED_DUMP_CHUNK, "ibuf");
+			goto finish;
+		}
+		ssize_t n = coio_call(dump_read_cb, fd, buf.wpos,
+				      ibuf_unused(&buf));
+		if (n < 0) {
+			memcached_error_SERVER_ERROR("Failed to read '%s'", path);
+			goto finish;
+		}
+		eof = (n == 0);
+		buf.wpos += n;
+		if (!header) {
+			if (ibuf_used(&buf) < MEMCACHED_DUMP_MAGIC_LEN && !eof)
+				continue;
+			if (ibuf_used(&buf) < MEMCACHED_DUMP_MAGIC_LEN ||
+			    memcmp(buf.rpos, MEMCACHED_DUMP_MAGIC,
+				   MEMCACHED_DUMP_MAGIC_LEN) != 0) {
+				memcached_error_SERVER_ERROR("'%s' is not a "
+							     "memcached dump",
+							     path);
+				goto finish;
+			}
+			buf.rpos += MEMCACHED_DUMP_MAGIC_LEN;
+			header = true;
+		}
+		int rv = 0;
+		if (format == MEMCACHED_DUMP_BINARY) {
+			rv = dump_import_binary(&imp, &buf);
+		} else {
+			rv = dump_import_text(&imp, &buf);
+		}
+		/* Don't keep transaction open while reading */
+		if (rv == -1 || dump_import_commit(&imp) == -1)
+			goto finish;
+	}
+	if (ibuf_used(&buf) > 0) {
+		memcached_error_SERVER_ERROR("Unexpected end of '%s'", path);
+		goto finish;
+	}
+	say_info("Imported %zd items from '%s', %zd expired skipped",
+		 imp.count, path, imp.skipped);
+	rc = imp.count;
+finish:
+	if (box_txn())
+		box_txn_rollback();
+	region_destroy(&imp.con.scratch);
+	ibuf_destroy(&buf);
+	close(fd);
+	return rc;
+}
+
+/* Executed in coio thread */
+static ssize_t
+dump_write_cb(va_list ap)
+{
+	int fd          = va_arg(ap, int);
+	const char *buf = va_arg(ap, const char *);
+	size_t len      = va_arg(ap, size_t);
+	size_t written  = 0;
+	while (written < len) {
+		ssize_t n = write(fd, buf + written, len - written);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			return -1;
+		written += n;
+	}
+	return written;
+}
+
+/* Executed in coio thread */
+static ssize_t
+dump_fsync_cb(va_list ap)
+{
+	int fd = va_arg(ap, int);
+	return fsync(fd);
+}
+
+struct dump_item {
+	const char *key;
+	uint32_t    key_len;
+	uint64_t    expire;
+	const char *val;
+	uint32_t    val_len;
+	uint64_t    cas;
+	uint32_t    flags;
+};
+
+static inline void
+dump_item_decode(box_tuple_t *tuple, struct dump_item *item)
+{
+	const char *pos = box_tuple_field(tuple, 0);
+	item->key     = mp_decode_str(&pos, &item->key_len);
+	item->expire  = mp_decode_uint(&pos);
+	mp_next(&pos);
+	item->val     = mp_decode_str(&pos, &item->val_len);
+	item->cas     = mp_decode_uint(&pos);
+	item->flags   = mp_decode_uint(&pos);
+}
+
+/* Absolute expiration time in seconds, as the import expects it */
+static inline uint32_t
+dump_item_exptime(struct dump_item *item)
+{
+	if (item->expire == UINT64_MAX)
+		return 0;
+	return (item->expire + 999999) / 1000000;
+}
+
+static int
+dump_encode_item(struct ibuf *buf, enum memcached_dump_format format,
+		 struct dump_item *item)
+{
+	/* text command line is at most 'set <key> <u32> <u32> <u32>\r\n' */
+	size_t len = item->key_len + item->val_len +
+		     (format == MEMCACHED_DUMP_BINARY ?
+		      sizeof(struct memcached_dump_rec) : 48);
+	char *pos = ibuf_reserve(buf, len);
+	if (pos == NULL) {
+		memcached_error_ENOMEM(len, "ibuf");
+		return -1;
+	}
+	if (format == MEMCACHED_DUMP_BINARY) {
+		struct memcached_dump_rec *rec = (struct memcached_dump_rec *)pos;
+		rec->flags   = mp_bswap_u32(item->flags);
+		rec->expire  = mp_bswap_u32(dump_item_exptime(item));
+		rec->key_len = mp_bswap_u16(item->key_len);
+		rec->val_len = mp_bswap_u32(item->val_len);
+		pos += sizeof(struct memcached_dump_rec);
+		memcpy(pos, item->key, item->key_len);
+		pos += item->key_len;
+		memcpy(pos, item->val, item->val_len);
+		pos += item->val_len;
+	} else {
+		pos += sprintf(pos, "set %.*s %" PRIu32 " %" PRIu32
+			       " %" PRIu32 "\r\n", (int )item->key_len,
+			       item->key, item->flags, dump_item_exptime(item),
+			       item->val_len);
+		memcpy(pos, item->val, item->val_len);
+		pos += item->val_len;
+		memcpy(pos, "\r\n", 2);
+		pos += 2;
+	}
+	buf->wpos = pos;
+	return 0;
+}
+
+static inline int
+dump_write(int fd, struct ibuf *buf, const char *path)
+{
+	ssize_t n = coio_call(dump_write_cb, fd, buf->rpos, ibuf_used(buf));
+	if (n < 0) {
+		memcached_error_SERVER_ERROR("Failed to write '%s'", path);
+		return -1;
+	}
+	ibuf_reset(buf);
+	return 0;
+}
+
+/**
+ * Export every live item into file in 'format', readable by
+ * memcached_dump_import(). Items are encoded by chunks without
+ * yielding, chunks are written in coio thread, so the file is
+ * consistent per chunk, not for the whole space. Dump is written
+ * into '<path>.inprogress' and renamed after successful fsync.
+ *
+ * \returns count of exported items or -1 on error
+ */
+ssize_t
+memcached_dump_export(struct memcached_service *p, const char *path,
+		      enum memcached_dump_format format)
+{
+	/* Dump must have sets, that are still in coalescing buffer */
+	if (memcached_sync(p) == -1)
+		return -1;
+
+	char tmp[PATH_MAX];
+	snprintf(tmp, PATH_MAX, "%s.inprogress", path);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		memcached_error_SERVER_ERROR("Can't open '%s' for writing: %s",
+					     tmp, strerror(errno));
+		return -1;
+	}
+
+	struct ibuf buf;
+	ibuf_create(&buf, cord_slab_cache(), MEMCACHED_DUMP_CHUNK);
+
+	ssize_t rc = -1, count = 0;
+	uint32_t part = 0;
+	box_iterator_t *iter = memcached_partition_iterator(p, part);
+	if (iter == NULL)
+		goto finish;
+	if (format == MEMCACHED_DUMP_BINARY) {
+		if (ibuf_reserve(&buf, MEMCACHED_DUMP_MAGIC_LEN) == NULL) {
+			memcached_error_ENOMEM(MEMCACHED_DUMP_MAGIC_LEN, "ibuf");
+			goto finish;
+		}
+		memcpy(buf.wpos, MEMCACHED_DUMP_MAGIC, MEMCACHED_DUMP_MAGIC_LEN);
+		buf.wpos += MEMCACHED_DUMP_MAGIC_LEN;
+	}
+	for (;;) {
+		box_tuple_t *tpl = NULL;
+		if (box_iterator_next(iter, &tpl) == -1)
+			goto finish;
+		if (tpl == NULL && ++part < p->partition_count) {
+			box_iterator_free(iter);
+			iter = memcached_partition_iterator(p, part);
+			if (iter == NULL)
+				goto finish;
+			continue;
+		}
+		if (tpl != NULL) {
+			if (is_expired_tuple(p, tpl))
+				continue;
+			struct dump_item item;
+			dump_item_decode(tpl, &item);
+			if (dump_encode_item(&buf, format, &item) == -1)
+				goto finish;
+			count++;
+			if (ibuf_used(&buf) < MEMCACHED_DUMP_CHUNK)
+				continue;
+		}
+		if (ibuf_used(&buf) > 0 && dump_write(fd, &buf, tmp) == -1)
+			goto finish;
+		if (tpl == NULL)
+			break;
+	}
+	if (coio_call(dump_fsync_cb, fd) == -1) {
+		memcached_error_SERVER_ERROR("Failed to sync '%s'", tmp);
+		goto finish;
+	}
+	if (rename(tmp, path) == -1) {
+		memcached_error_SERVER_ERROR("Can't rename '%s' to '%s': %s",
+					     tmp, path, strerror(errno));
+		goto finish;
+	}
+	say_info("Exported %zd items to '%s'", count, path);
+	rc = count;
+finish:
+	if (iter)
+		box_iterator_free(iter);
+	ibuf_destroy(&buf);
+	close(fd);
+	if (rc == -1)
+		unlink(tmp);
+	return rc;
+}
+
+/**
+ * 'stats dump': stream metadata of every live item as a stat with
+ * the item's key. Output is flushed every MEMCACHED_DUMP_STAT_BATCH
+ * items, so it doesn't accumulate the whole space in memory, and the
+ * fiber yields after every flush, so the scan doesn't block serving of
+ * other connections. Like export, the dump is consistent per batch.
+ */
+int
+memcached_dump_stat(struct memcached_connection *con, stat_func_t append)
+{
+	struct memcached_service *p = con->cfg;
+	uint32_t part = 0;
+	box_iterator_t *iter = memcached_partition_iterator(p, part);
+	if (iter == NULL)
+		return -1;
+	int rc = -1, in_batch = 0;
+	bool streamed = false;
+	for (;;) {
+		box_tuple_t *tpl = NULL;
+		if (box_iterator_next(iter, &tpl) == -1)
+			goto finish;
+		if (tpl == NULL && ++part < p->partition_count) {
+			box_iterator_free(iter);
+			iter = memcached_partition_iterator(p, part);
+			if (iter == NULL)
+				goto finish;
+			continue;
+		}
+		if (tpl == NULL)
+			break;
+		if (is_expired_tuple(p, tpl))
+			continue;
+		struct dump_item item;
+		dump_item_decode(tpl, &item);
+		char name[256];
+		uint32_t name_len = item.key_len > 255 ? 255 : item.key_len;
+		memcpy(name, item.key, name_len);
+		name[name_len] = '\0';
+		if (append(con, name, "exp=%" PRIu32 " cas=%" PRIu64
+			   " flags=%" PRIu32 " size=%" PRIu32,
+			   dump_item_exptime(&item), item.cas, item.flags,
+			   item.val_len) == -1)
+			goto finish;
+		if (++in_batch < MEMCACHED_DUMP_STAT_BATCH)
+			continue;
+		in_batch = 0;
+		streamed = true;
+		if (memcached_stream(con) == -1)
+			goto finish;
+		/* writev yields only if socket is full */
+		fiber_sleep(0);
+	}
+	if (append(con, NULL, NULL) == -1)
+		goto finish;
+	rc = 0;
+finish:
+	/* the reply is half sent, there's no way to report an error */
+	if (rc == -1 && streamed)
+		con->close_connection = true;
+	if (iter)
+		box_iterator_free(iter);
+	return rc;
+}
@@ -0,0 +1,47 @@
+#ifndef   DUMP_H_INCLUDED
+#define   DUMP_H_INCLUDED
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct memcached_service;
+struct memcached_connection;
+
+enum memcached_dump_format {
+	MEMCACHED_DUMP_BINARY = 0x00,
+	MEMCACHED_DUMP_TEXT   = 0x01,
+	MEMCACHED_DUMP_MAX
+};
+
+/**
+ * Binary dump is a header followed by records:
+ *
+ * +--------+-----------------+-----+-------+
+ * | header | record          | ... | ..... |
+ * +--------+-----------------+-----+-------+
+ *
+ * Every record is 'struct memcached_dump_rec' (big-endian) followed by key
+ * and value. 'expire' is absolute unix time in seconds, 0 means never.
+ */
+#define MEMCACHED_DUMP_MAGIC     "TNTMCD\x00\x01"
+#define MEMCACHED_DUMP_MAGIC_LEN 8
+
+struct __attribute__((__packed__)) memcached_dump_rec {
+	uint32_t flags;
+	uint32_t expire;
+	uint16_t key_len;
+	uint32_t val_len;
+};
+
+ssize_t
+memcached_dump_import(struct memcached_service *p, const char *path,
+		      enum memcached_dump_format format, int batch);
+
+ssize_t
+memcached_dump_export(struct memcached_service *p, const char *path,
+		      enum memcached_dump_format format);
+
+int
+memcached_dump_stat(struct memcached_connection *con, stat_func_t append);
+
+#endif /* DUMP_H_INCLUDED */
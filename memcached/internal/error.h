@@ -53,4 +53,14 @@
 		say_error((fmtstr), ##__VA_ARGS__);					\
 	} while (0)
 
+/* Not logged, it's an expected answer of a replica */
+#define memcached_error_READ_ONLY(_master)						\
+	box_error_raise(box_error_code_MAX + MEMCACHED_RES_SERVER_ERROR,		\
+			"Read only replica, send writes to '%s'",			\
+			(_master) ? (_master) : "master")
+
+/* Not logged, request is shed under overload */
+#define memcached_error_BUSY()								\
+	box_error_raise(box_error_code_MAX + MEMCACHED_RES_EBUSY, "busy")
+
 #endif /* ERROR_H_INCLUDED */
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <stdbool.h>
@@ -8,11 +9,21 @@
 
 #include "memcached.h"
 #include "memcached_layer.h"
+#include "expiration.h"
 
 #include "error.h"
 
+/**
+ * Delete expired tuples of the next batch. Sizes of live tuples are
+ * summed in 'scanned', memory usage of the partition is set to the sum,
+ * when the pass is over.
+ *
+ * \returns count of checked tuples or -1 on error
+ */
 int
-memcached_expire_process(struct memcached_service *p, box_iterator_t **iterp)
+memcached_expire_process(struct memcached_service *p,
+			 struct memcached_partition *part,
+			 box_iterator_t **iterp, uint64_t *scanned)
 {
 	box_iterator_t *iter = *iterp;
 	box_tuple_t *tpl = NULL;
@@ -28,8 +39,12 @@ memcached_expire_process(struct memcached_service *p, box_iterator_t **iterp)
 				return -1;
 			}
 			*iterp = NULL;
-			return 0;
-		} else if (is_expired_tuple(p, tpl)) {
+			part->bytes = *scanned;
+			*scanned = 0;
+			return i;
+		} else if (!is_expired_tuple(p, tpl)) {
+			*scanned += box_tuple_bsize(tpl);
+		} else {
 			uint32_t klen = 0;
 			const char *kpos = box_tuple_field(tpl, 0);
 			            kpos = mp_decode_str(&kpos, &klen);
@@ -42,30 +57,166 @@ memcached_expire_process(struct memcached_service *p, box_iterator_t **iterp)
 			}
 			char *end = mp_encode_array(begin, 1);
 			      end = mp_encode_str(end, kpos, klen);
-			if (box_delete(p->space_id, 0, begin, end, NULL)) {
+			if (box_delete(part->space_id, 0, begin, end, NULL)) {
 				box_txn_rollback();
 				return -1;
 			}
 			p->stat.evictions++;
+			part->evictions++;
+			size_t size = box_tuple_bsize(tpl);
+			part->bytes -= (size < part->bytes ? size : part->bytes);
 		}
 	}
 	if (box_txn_commit() == -1) {
 		return -1;
 	}
-	return 0;
+	return i;
+}
+
+/* Bounds of the pace and lag thresholds of the expiration controller */
+#define EXPIRE_PACE_MIN  0.125
+#define EXPIRE_PACE_MAX  8.0
+#define EXPIRE_LAG_BUSY  0.01
+#define EXPIRE_LAG_IDLE  0.001
+
+/**
+ * Adjust pace of the scan (1 is a full scan in 'expire_full_scan_time')
+ * after a batch: back off, when event loop lags, speed up, when the loop
+ * is idle and a lot of checked tuples are expired, or tenant is close to
+ * its quota, and return to the configured pace otherwise.
+ */
+static double
+memcached_expire_pace(struct memcached_service *p,
+		      struct memcached_partition *part, double pace,
+		      int checked, uint64_t expired, double lag)
+{
+	if (!p->expire_adaptive)
+		return 1;
+	if (p->overload.lag > lag)
+		lag = p->overload.lag;
+	bool pressure = (part->quota > 0 && part->bytes > part->quota / 10 * 9);
+	bool garbage  = (checked > 0 && expired * 4 > (uint64_t )checked);
+	if (lag > EXPIRE_LAG_BUSY) {
+		if (pace > EXPIRE_PACE_MIN) {
+			pace /= 2;
+			p->stat.expire_backoffs++;
+		}
+	} else if (lag < EXPIRE_LAG_IDLE && (garbage || pressure)) {
+		if (pace < EXPIRE_PACE_MAX) {
+			pace *= 2;
+			p->stat.expire_speedups++;
+		}
+	} else if (pace > 1) {
+		pace /= 2;
+	} else if (pace < 1) {
+		pace *= 2;
+	}
+	p->stat.expire_pace = pace * 100;
+	return pace;
 }
 
+/* Sampling: repeat at once, while more than the percent of the sample was
+ * expired, up to the count of rounds, and then rest for the period */
+#define EXPIRE_SAMPLE_REPEAT  25
+#define EXPIRE_SAMPLE_ROUNDS  16
+#define EXPIRE_SAMPLE_PERIOD  0.1
+
+/**
+ * Delete expired tuples among 'expire_count' random ones, so work is
+ * proportional to the rate of expiration, not to the size of the space.
+ *
+ * \returns count of expired tuples or -1 on error
+ */
+static int
+memcached_expire_sample(struct memcached_service *p,
+			struct memcached_partition *part)
+{
+	int expired = 0;
+	box_txn_begin();
+	for (int i = 0; i < p->expire_count; ++i) {
+		box_tuple_t *tpl = NULL;
+		if (box_index_random(part->space_id, 0, rand(), &tpl) == -1) {
+			box_txn_rollback();
+			return -1;
+		}
+		if (tpl == NULL)
+			break;
+		p->stat.expire_sampled++;
+		if (!is_expired_tuple(p, tpl))
+			continue;
+		uint32_t klen = 0;
+		const char *kpos = box_tuple_field(tpl, 0);
+		            kpos = mp_decode_str(&kpos, &klen);
+		size_t sz   = mp_sizeof_array(1) + mp_sizeof_str(klen);
+		char *begin = (char *)box_txn_alloc(sz);
+		if (begin == NULL) {
+			box_txn_rollback();
+			memcached_error_ENOMEM(sz, "key");
+			return -1;
+		}
+		char *end = mp_encode_array(begin, 1);
+		      end = mp_encode_str(end, kpos, klen);
+		size_t size = box_tuple_bsize(tpl);
+		if (box_delete(part->space_id, 0, begin, end, NULL)) {
+			box_txn_rollback();
+			return -1;
+		}
+		p->stat.evictions++;
+		part->evictions++;
+		part->bytes -= (size < part->bytes ? size : part->bytes);
+		expired++;
+	}
+	if (box_txn_commit() == -1) {
+		return -1;
+	}
+	return expired;
+}
+
+/* Every partition is scanned by its own fiber with its own cursor */
 int
 memcached_expire_loop(va_list ap)
 {
 	struct memcached_service *p = va_arg(ap, struct memcached_service *);
+	struct memcached_partition *part = va_arg(ap,
+						  struct memcached_partition *);
 	char key[2], *key_end = mp_encode_array(key, 0);
 	box_iterator_t *iter = NULL;
-	int rv = 0;
+	uint64_t scanned = 0;
+	double pace = 1, lag = 0;
+	int rv = 0, rounds = 0;
 	say_info("Memcached expire fiber started");
 restart:
+	if (p->expire_strategy == MEMCACHED_EXPIRE_SAMPLE) {
+		if (iter != NULL) {
+			box_iterator_free(iter);
+			iter = NULL;
+			scanned = 0;
+		}
+		rv = memcached_expire_sample(p, part);
+		if (rv == -1) {
+			const box_error_t *err = box_error_last();
+			say_error("Unexpected error %u: %s",
+					box_error_code(err),
+					box_error_message(err));
+			goto finish;
+		}
+		double delay = EXPIRE_SAMPLE_PERIOD;
+		if (rv * 100 > p->expire_count * EXPIRE_SAMPLE_REPEAT &&
+		    ++rounds < EXPIRE_SAMPLE_ROUNDS) {
+			delay = 0;
+		} else {
+			rounds = 0;
+		}
+		fiber_set_cancellable(true);
+		fiber_sleep(delay);
+		if (fiber_is_cancelled())
+			goto finish;
+		fiber_set_cancellable(false);
+		goto restart;
+	}
 	if (iter == NULL) {
-		iter = box_index_iterator(p->space_id, 0, ITER_ALL, key, key_end);
+		iter = box_index_iterator(part->space_id, 0, ITER_ALL,
+					  key, key_end);
 	}
 	if (rv == -1 || iter == NULL) {
 		const box_error_t *err = box_error_last();
@@ -74,7 +225,8 @@ restart:
 				box_error_message(err));
 		goto finish;
 	}
-	rv = memcached_expire_process(p, &iter);
+	uint64_t evictions = part->evictions;
+	rv = memcached_expire_process(p, part, &iter, &scanned);
 	if (rv == -1) {
 		const box_error_t *err = box_error_last();
 		say_error("Unexpected error %u: %s",
@@ -82,13 +234,20 @@ restart:
 				box_error_message(err));
 		goto finish;
 	}
+	pace = memcached_expire_pace(p, part, pace, rv,
+				     part->evictions - evictions, lag);
 
 	/* This part is where we rest after all deletes */
 	double delay = ((double )p->expire_count * p->expire_time) /
-			(box_index_len(p->space_id, 0) + 1);
+			(box_index_len(part->space_id, 0) + 1);
 	if (delay > 1) delay = 1;
+	/* pace is applied to the capped delay, so it works for any space */
+	delay /= pace;
 	fiber_set_cancellable(true);
+	/* oversleep is the lag of event loop */
+	double start = fiber_clock();
 	fiber_sleep(delay);
+	lag = fiber_clock() - start - delay;
 	if (fiber_is_cancelled())
 		goto finish;
 	fiber_set_cancellable(false);
@@ -100,33 +259,79 @@ finish:
 	return 0;
 }
 
+/**
+ * Run a full pass over the space and delete every expired tuple.
+ * Used before checkpointing, so the snapshot doesn't carry items
+ * nobody can read anymore.
+ */
+int
+memcached_expire_purge(struct memcached_service *p)
+{
+	for (uint32_t i = 0; i < p->partition_count; ++i) {
+		struct memcached_partition *part = &p->partitions[i];
+		box_iterator_t *iter = memcached_partition_iterator(p, i);
+		if (iter == NULL)
+			return -1;
+		uint64_t scanned = 0;
+		while (iter != NULL) {
+			if (memcached_expire_process(p, part, &iter,
+						     &scanned) == -1) {
+				if (iter)
+					box_iterator_free(iter);
+				return -1;
+			}
+			/* Let the others work between batches */
+			fiber_sleep(0);
+		}
+	}
+	return 0;
+}
+
 int
 memcached_expire_start(struct memcached_service *p)
 {
-	if (p->expire_fiber != NULL)
-		return -1;
-	struct fiber *expire_fiber = NULL;
-	char name[128];
-	snprintf(name, 128, "__mc_%s_expire", p->name);
-	expire_fiber = fiber_new(name, memcached_expire_loop);
-	const box_error_t *err = box_error_last();
-	if (err) {
-		say_error("Can't start the expire fiber");
-		say_error("%s", box_error_message(err));
-		return -1;
+	/* Already running */
+	if (p->partitions[0].expire_fiber != NULL)
+		return 0;
+	/* Replica gets deletes of expired items from master */
+	if (p->read_only)
+		return 0;
+	/* Items of proxy live on backends */
+	if (p->proxy != NULL)
+		return 0;
+	for (uint32_t i = 0; i < p->partition_count; ++i) {
+		struct fiber *expire_fiber = NULL;
+		char name[128];
+		if (p->partition_count == 1)
+			snprintf(name, 128, "__mc_%s_expire", p->name);
+		else
+			snprintf(name, 128, "__mc_%s_expire_%" PRIu32,
+				 p->name, i);
+		expire_fiber = fiber_new(name, memcached_expire_loop);
+		const box_error_t *err = box_error_last();
+		if (err) {
+			say_error("Can't start the expire fiber");
+			say_error("%s", box_error_message(err));
+			memcached_expire_stop(p);
+			return -1;
+		}
+		p->partitions[i].expire_fiber = expire_fiber;
+		fiber_set_joinable(expire_fiber, true);
+		fiber_start(expire_fiber, p, &p->partitions[i]);
 	}
-	p->expire_fiber = expire_fiber;
-	fiber_set_joinable(expire_fiber, true);
-	fiber_start(expire_fiber, p);
 	return 0;
 }
 
 void
 memcached_expire_stop(struct memcached_service *p)
 {
-	if (p->expire_fiber == NULL) return;
-	fiber_cancel(p->expire_fiber);
-	fiber_join(p->expire_fiber);
-	p->expire_fiber = NULL;
+	for (uint32_t i = 0; i < p->partition_count; ++i) {
+		struct memcached_partition *part = &p->partitions[i];
+		if (part->expire_fiber == NULL)
+			continue;
+		fiber_cancel(part->expire_fiber);
+		fiber_join(part->expire_fiber);
+		part->expire_fiber = NULL;
+	}
 }
 
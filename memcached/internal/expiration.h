@@ -7,4 +7,7 @@ memcached_expire_start(struct memcached_service *p);
 void
 memcached_expire_stop(struct memcached_service *p);
 
+int
+memcached_expire_purge(struct memcached_service *p);
+
 #endif /* EXPIRATION_H_INCLUDED */
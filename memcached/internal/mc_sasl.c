@@ -272,3 +272,15 @@ int memcached_sasl_step(struct memcached_connection *con,
 	return -1;
 }
 
+/* Name of the authenticated user or NULL */
+const char *
+memcached_sasl_username(struct memcached_connection *con)
+{
+	const char *user = NULL;
+	if (con->sasl_ctx == NULL || con->sasl_ctx->sasl_conn == NULL)
+		return NULL;
+	if (sasl_getprop(con->sasl_ctx->sasl_conn, SASL_USERNAME,
+			 (const void **)&user) != SASL_OK)
+		return NULL;
+	return user;
+}
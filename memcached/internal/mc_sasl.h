@@ -21,6 +21,7 @@ int memcached_sasl_list_mechs(struct memcached_connection *con,
 int memcached_sasl_auth(struct memcached_connection *con, const char *mech,
 			const char *challenge, size_t challenge_len,
 			const char **out, size_t *out_len);
+const char *memcached_sasl_username(struct memcached_connection *con);
 int memcached_sasl_step(struct memcached_connection *con,
 			const char *challenge, size_t challenge_len,
 			const char **out, size_t *out_len);
@@ -29,6 +29,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <stdbool.h>
@@ -44,6 +45,12 @@
 #include "proto_bin.h"
 #include "proto_txt.h"
 #include "expiration.h"
+#include "proxy.h"
+#include "vbucket.h"
+#include "coalesce.h"
+#include "ratelimit.h"
+#include "overload.h"
+#include "priority.h"
 #include "mc_sasl.h"
 
 static inline int
@@ -78,6 +85,24 @@ memcached_flush(struct memcached_connection *con) {
 	return total;
 }
 
+/**
+ * Write out the output buffer in the middle of processing a request,
+ * used by commands with long replies. Input buffer is left untouched,
+ * since the request is still in it.
+ */
+int
+memcached_stream(struct memcached_connection *con)
+{
+	size_t size  = obuf_size(con->out);
+	size_t total = mnet_writev(con->fd, con->out->iov,
+				   obuf_iovcnt(con->out), size);
+	con->cfg->stat.bytes_written += total;
+	obuf_reset(con->out);
+	if (total < size)
+		return -1;
+	return 0;
+}
+
 static inline int
 memcached_loop_read(struct memcached_connection *con, size_t to_read)
 {
@@ -151,12 +176,14 @@ memcached_loop(struct memcached_connection *con)
 			 */
 			break;
 		}
+		con->read_time = fiber_clock();
 		to_read = 1;
 next:
 		con->noreply = false;
 		con->noprocess = false;
 		rc = con->cb.parse_request(con);
 		if (rc == -1) {
+			memcached_proxy_collect(con);
 			memcached_loop_error(con);
 			con->write_end = obuf_create_svp(con->out);
 			if (con->close_connection) {
@@ -167,31 +194,53 @@ next:
 				memcached_skip_request(con);
 			}
 			memcached_flush(con);
+			memcached_priority_end(con);
+			memcached_scratch_reset(con);
 			batch_count = 0;
 			continue;
 		} else if (rc > 0) {
+			/* Connection waits for the rest of request */
+			memcached_priority_end(con);
 			to_read = rc;
 			batch_count = 0;
 			continue;
 		}
 		assert(!con->close_connection);
+		/* Whole request is read, the connection has work to do */
+		memcached_priority_begin(con);
 		rc = 0;
-		if (!con->noprocess) rc = con->cb.process_request(con);
+		if (!con->noprocess) {
+			memcached_coalesce_throttle(con->cfg->coalesce);
+			memcached_priority_yield(con);
+			rc = memcached_overload_check(con);
+			if (rc == 0)
+				rc = con->cb.process_request(con);
+			else if (con->noreply)
+				rc = 0;
+		}
 		con->write_end = obuf_create_svp(con->out);
+		memcached_limit_charge(con, con->len);
 		memcached_skip_request(con);
 		if (rc == -1)
 			memcached_loop_error(con);
 		if (con->close_connection) {
 			say_debug("Requesting exit. Exiting.");
 			break;
-		} else if (rc == 0 && ibuf_used(con->in) > 0 &&
-			   batch_count < con->cfg->batch_count) {
+		}
+		if (rc == 0 && ibuf_used(con->in) > 0 &&
+		    batch_count < memcached_priority_batch(con) &&
+		    !memcached_limit_exceeded(con)) {
 			batch_count++;
 			goto next;
 		}
 		/* Write back answer */
+		memcached_proxy_collect(con);
 		if (!con->noreply)
 			memcached_flush(con);
+		memcached_priority_end(con);
+		memcached_scratch_reset(con);
+		/* Client over its rate isn't read for a while */
+		memcached_limit_wait(con);
 		fiber_reschedule();
 		batch_count = 0;
 		continue;
@@ -210,6 +259,7 @@ memcached_handler(struct memcached_service *p, int fd)
 	con.out                 = obuf_new();
 	con.write_end           = obuf_create_svp(con.out);
 	con.cfg                 = p;
+	region_create(&con.scratch, cord_slab_cache());
 	con.authentication_step = false;
 	con.sasl_ctx            = (struct sasl_ctx *)calloc(1,
 			sizeof(struct sasl_ctx));
@@ -223,9 +273,11 @@ memcached_handler(struct memcached_service *p, int fd)
 	}
 
 	/* prepare connection type */
-	if (p->proto == MEMCACHED_PROTO_NEGOTIATION && p->sasl != true) {
+	bool binary_only = (p->sasl == true || p->proxy != NULL ||
+			    p->vbuckets != NULL);
+	if (p->proto == MEMCACHED_PROTO_NEGOTIATION && !binary_only) {
 		con.cb.parse_request = memcached_loop_negotiate;
-	} else if (p->proto == MEMCACHED_PROTO_BINARY || p->sasl == true) {
+	} else if (p->proto == MEMCACHED_PROTO_BINARY || binary_only) {
 		memcached_set_bin(&con);
 	} else if (p->proto == MEMCACHED_PROTO_TEXT) {
 		memcached_set_txt(&con);
@@ -237,9 +289,12 @@ memcached_handler(struct memcached_service *p, int fd)
 	con.cfg->stat.curr_conns++;
 	con.cfg->stat.total_conns++;
 	memcached_loop(&con);
+	memcached_priority_end(&con);
+	memcached_proxy_detach(&con);
 	/* close connection and reflect it in stats */
 	con.cfg->stat.curr_conns--;
 	iobuf_delete(con.in, con.out);
+	region_destroy(&con.scratch);
 	free((void *)con.sasl_ctx);
 	const box_error_t *err = box_error_last();
 	if (err)
@@ -258,19 +313,27 @@ memcached_create(const char *name, uint32_t sid)
 		return NULL;
 	}
 	srv->batch_count    = 20;
+	srv->priority       = MEMCACHED_PRIORITY_NORMAL;
 	srv->expire_enabled = true;
 	srv->expire_count   = 50;
 	srv->expire_time    = 3600;
-	srv->expire_fiber   = NULL;
-	srv->space_id       = sid;
+	srv->expire_adaptive = true;
+	srv->stat.expire_pace = 100;
+	srv->partitions     = (struct memcached_partition *)
+		calloc(1, sizeof(struct memcached_partition));
+	srv->partition_count = 1;
+	srv->hash_count     = 1;
 	srv->name           = strdup(name);
 	srv->cas            = 1;
 	srv->readahead      = 16384;
-	if (!srv->name) {
+	if (!srv->name || !srv->partitions) {
 		say_syserror("failed to allocate memory for memcached service");
+		free((void *)srv->name);
+		free(srv->partitions);
 		free(srv);
 		return NULL;
 	}
+	srv->partitions[0].space_id = sid;
 	return srv;
 }
 
@@ -278,25 +341,161 @@ void
 memcached_free(struct memcached_service *srv)
 {
 	memcached_stop(srv);
-	if (srv) free((void *)srv->name);
+	if (srv) {
+		free((void *)srv->name);
+		free(srv->master);
+		memcached_proxy_delete(srv->proxy);
+		free(srv->vbuckets);
+		for (uint32_t i = 0; srv->partitions != NULL &&
+				    i < srv->partition_count; ++i) {
+			free(srv->partitions[i].name);
+			free(srv->partitions[i].prefix);
+		}
+		free(srv->partitions);
+		memcached_coalesce_delete(srv->coalesce);
+		memcached_limit_free_users(srv);
+		memcached_clear_user_priorities(srv);
+		memcached_admission_delete(srv->admission);
+		memcached_sliding_delete(srv->sliding);
+	}
 	free(srv);
 }
 
 int
 memcached_start (struct memcached_service *srv)
 {
+	srv->running = true;
+	/* Requests of a proxy are shed too */
+	if (memcached_overload_start(srv) == -1)
+		return -1;
+	/* Items live on backends in proxy mode: they aren't expired and
+	 * sets aren't buffered */
+	if (srv->proxy != NULL)
+		return memcached_proxy_start(srv->proxy, &srv->stat);
 	/* Run expiration fiber only if expire_enabled is true */
 	if (srv->expire_enabled == true && memcached_expire_start(srv) == -1)
 		return -1;
-	return 0;
+	return memcached_coalesce_start(srv->coalesce, srv->name);
 }
 
 void
 memcached_stop (struct memcached_service *srv)
 {
+	srv->running = false;
 	memcached_expire_stop(srv);
+	memcached_overload_stop(srv);
 	while (srv->stat.curr_conns != 0)
 		fiber_sleep(0.001);
+	memcached_coalesce_stop(srv->coalesce);
+	if (srv->proxy != NULL)
+		memcached_proxy_stop(srv->proxy);
+}
+
+int
+memcached_purge (struct memcached_service *srv)
+{
+	if (memcached_sync(srv) == -1)
+		return -1;
+	return memcached_expire_purge(srv);
+}
+
+/* Write sets, pending in coalescing buffer, to the spaces */
+int
+memcached_sync (struct memcached_service *srv)
+{
+	return memcached_coalesce_flush(srv->coalesce);
+}
+
+/**
+ * Replicated tuples carry CAS assigned by the master, keep the local
+ * counter above them, so CAS stays unique after the replica is
+ * promoted.
+ */
+void
+memcached_cas_observe (struct memcached_service *srv, uint64_t cas)
+{
+	if (cas >= srv->cas)
+		srv->cas = cas + 1;
+}
+
+uint64_t
+memcached_flush_time (struct memcached_service *srv)
+{
+	return srv->flush;
+}
+
+/**
+ * Store key space in 'count' spaces, followed by spaces of 'tenants'.
+ * The array is allocated once, connections and expiration fibers keep
+ * pointers to partitions. Must be called on creation, before start.
+ */
+int
+memcached_set_partitions (struct memcached_service *srv, uint32_t count,
+			  uint32_t tenants, const uint32_t *space_ids)
+{
+	if (count == 0 || srv->running)
+		return -1;
+	struct memcached_partition *partitions = (struct memcached_partition *)
+		calloc(count + tenants, sizeof(struct memcached_partition));
+	if (partitions == NULL) {
+		say_syserror("failed to allocate memory for partitions");
+		return -1;
+	}
+	for (uint32_t i = 0; i < count + tenants; ++i)
+		partitions[i].space_id = space_ids[i];
+	free(srv->partitions);
+	srv->partitions      = partitions;
+	srv->partition_count = count + tenants;
+	srv->hash_count      = count;
+	return 0;
+}
+
+/**
+ * Store keys with the prefix in the space of i-th tenant. Tenants are
+ * set after partitions, longer prefixes first.
+ */
+int
+memcached_set_tenant (struct memcached_service *srv, uint32_t i,
+		      const char *name, const char *prefix, uint64_t quota,
+		      uint64_t bytes)
+{
+	if (srv->hash_count + i >= srv->partition_count)
+		return -1;
+	struct memcached_partition *part = &srv->partitions[srv->hash_count + i];
+	part->name   = strdup(name);
+	part->prefix = strdup(prefix);
+	if (part->name == NULL || part->prefix == NULL) {
+		say_syserror("failed to allocate memory for tenant");
+		free(part->name);
+		free(part->prefix);
+		part->name = part->prefix = NULL;
+		return -1;
+	}
+	part->prefix_len = strlen(prefix);
+	part->quota      = quota;
+	part->bytes      = bytes;
+	return 0;
+}
+
+uint32_t
+memcached_space_of (struct memcached_service *srv, const char *key,
+		    uint32_t key_len)
+{
+	return memcached_partition_of(srv, key, key_len)->space_id;
+}
+
+/* Buffer of pending sets is created by the first option, that needs it,
+ * its fibers of stopped service are started by memcached_start() */
+static struct memcached_coalesce *
+memcached_coalesce_of (struct memcached_service *srv)
+{
+	if (srv->coalesce == NULL) {
+		srv->coalesce = memcached_coalesce_new(&srv->stat);
+		if (srv->coalesce != NULL && srv->running &&
+		    srv->proxy == NULL)
+			memcached_coalesce_start(srv->coalesce, srv->name);
+	}
+	return srv->coalesce;
 }
 
 void
@@ -309,13 +508,14 @@ memcached_set_opt (struct memcached_service *srv, int opt, ...)
 		break;
 	case MEMCACHED_OPT_EXPIRE_ENABLED: {
 		int flag = (int )va_arg(va, int);
-		if (flag == 0) {
-			srv->expire_enabled = false;
-			memcached_expire_stop(srv);
-		} else {
-			srv->expire_enabled = true;
+		srv->expire_enabled = (flag != 0);
+		/* fibers of stopped service are started by memcached_start() */
+		if (!srv->running)
+			break;
+		if (srv->expire_enabled)
 			memcached_expire_start(srv);
-		}
+		else
+			memcached_expire_stop(srv);
 		break;
 	}
 	case MEMCACHED_OPT_EXPIRE_COUNT:
@@ -324,6 +524,46 @@ memcached_set_opt (struct memcached_service *srv, int opt, ...)
 	case MEMCACHED_OPT_EXPIRE_TIME:
 		srv->expire_time = (uint32_t )va_arg(va, double);
 		break;
+	case MEMCACHED_OPT_EXPIRE_ADAPTIVE:
+		srv->expire_adaptive = (bool )va_arg(va, int);
+		break;
+	case MEMCACHED_OPT_ADMISSION: {
+		const char *name = va_arg(va, const char *);
+		if (strcmp(name, "not_stored") == 0)
+			srv->admission_mode = MEMCACHED_ADMISSION_NOT_STORED;
+		else if (strcmp(name, "accept") == 0)
+			srv->admission_mode = MEMCACHED_ADMISSION_ACCEPT;
+		else
+			srv->admission_mode = MEMCACHED_ADMISSION_OFF;
+		if (srv->admission_mode != MEMCACHED_ADMISSION_OFF &&
+		    srv->admission == NULL)
+			srv->admission = memcached_admission_new();
+		break;
+	}
+	case MEMCACHED_OPT_EVICTION: {
+		const char *name = va_arg(va, const char *);
+		if (strcmp(name, "gdsf") == 0)
+			srv->eviction = MEMCACHED_EVICTION_GDSF;
+		else
+			srv->eviction = MEMCACHED_EVICTION_RANDOM;
+		if (srv->eviction == MEMCACHED_EVICTION_GDSF &&
+		    srv->admission == NULL)
+			srv->admission = memcached_admission_new();
+		break;
+	}
+	case MEMCACHED_OPT_SLIDING_FLAG:
+		srv->sliding_flag = (uint32_t )va_arg(va, double);
+		if (srv->sliding_flag != 0 && srv->sliding == NULL)
+			srv->sliding = memcached_sliding_new();
+		break;
+	case MEMCACHED_OPT_EXPIRE_STRATEGY: {
+		const char *name = va_arg(va, const char *);
+		if (strcmp(name, "sample") == 0)
+			srv->expire_strategy = MEMCACHED_EXPIRE_SAMPLE;
+		else
+			srv->expire_strategy = MEMCACHED_EXPIRE_SCAN;
+		break;
+	}
 	case MEMCACHED_OPT_FLUSH_ENABLED: {
 		int flag = (int )va_arg(va, int);
 		if (flag == 0) {
@@ -356,6 +596,16 @@ memcached_set_opt (struct memcached_service *srv, int opt, ...)
 					  "tication is enabled.");
 				return;
 			}
+			if (srv->proxy != NULL) {
+				say_error("Can't set Text protocol. Proxy mode "
+					  "is enabled.");
+				return;
+			}
+			if (srv->vbuckets != NULL) {
+				say_error("Can't set Text protocol. Vbuckets "
+					  "are enabled.");
+				return;
+			}
 			srv->proto = MEMCACHED_PROTO_TEXT;
 		} else {
 			/* unreacheable */
@@ -372,6 +622,132 @@ memcached_set_opt (struct memcached_service *srv, int opt, ...)
 		}
 		srv->sasl = true;
 		break;
+	case MEMCACHED_OPT_READ_ONLY: {
+		int flag = (int )va_arg(va, int);
+		srv->read_only = (flag != 0);
+		if (!srv->running)
+			break;
+		/* Expiration deletes are replicated from master */
+		if (srv->read_only) {
+			memcached_expire_stop(srv);
+		} else if (srv->expire_enabled) {
+			memcached_expire_start(srv);
+		}
+		break;
+	}
+	case MEMCACHED_OPT_MASTER: {
+		const char *master = va_arg(va, const char *);
+		char *copy = strdup(master);
+		if (copy == NULL) {
+			say_syserror("failed to allocate memory for master uri");
+			break;
+		}
+		free(srv->master);
+		srv->master = copy;
+		break;
+	}
+	case MEMCACHED_OPT_PROXY: {
+		const char *backends = va_arg(va, const char *);
+		if (srv->proxy != NULL) {
+			say_error("Can't change backends of running proxy");
+			break;
+		}
+		srv->proxy = memcached_proxy_new(backends);
+		if (srv->proxy != NULL && srv->proto == MEMCACHED_PROTO_TEXT)
+			srv->proto = MEMCACHED_PROTO_BINARY;
+		break;
+	}
+	case MEMCACHED_OPT_PROXY_CONNS:
+		if (srv->proxy != NULL)
+			memcached_proxy_set_connections(srv->proxy,
+					(int )va_arg(va, double));
+		break;
+	case MEMCACHED_OPT_PROXY_TIMEOUT:
+		if (srv->proxy != NULL)
+			memcached_proxy_set_timeout(srv->proxy,
+					va_arg(va, double));
+		break;
+	case MEMCACHED_OPT_HOT_REPLICAS:
+		if (srv->proxy != NULL)
+			memcached_proxy_set_hot(srv->proxy,
+					(int )va_arg(va, double), 0, 0);
+		break;
+	case MEMCACHED_OPT_HOT_THRESHOLD:
+		if (srv->proxy != NULL)
+			memcached_proxy_set_hot(srv->proxy, -1,
+					(uint32_t )va_arg(va, double), 0);
+		break;
+	case MEMCACHED_OPT_HOT_TTL:
+		if (srv->proxy != NULL)
+			memcached_proxy_set_hot(srv->proxy, -1, 0,
+					(uint32_t )va_arg(va, double));
+		break;
+	case MEMCACHED_OPT_VBUCKETS: {
+		uint32_t count = (uint32_t )va_arg(va, double);
+		if (count > 0 && srv->proto == MEMCACHED_PROTO_TEXT) {
+			say_error("Can't enable vbuckets. Text protocol is "
+				  "enabled.");
+			break;
+		}
+		memcached_vbucket_configure(srv, count);
+		break;
+	}
+	case MEMCACHED_OPT_COALESCE: {
+		double window = va_arg(va, double);
+		if (srv->coalesce == NULL && window <= 0)
+			break;
+		if (memcached_coalesce_of(srv) != NULL)
+			memcached_coalesce_set_window(srv->coalesce, window);
+		break;
+	}
+	case MEMCACHED_OPT_ASYNC_WRITERS: {
+		int writers = (int )va_arg(va, double);
+		if (srv->coalesce == NULL && writers <= 0)
+			break;
+		if (memcached_coalesce_of(srv) != NULL)
+			memcached_coalesce_set_async(srv->coalesce, writers, 0);
+		break;
+	}
+	case MEMCACHED_OPT_CONN_OPS:
+		srv->rates.conn_ops = va_arg(va, double);
+		break;
+	case MEMCACHED_OPT_CONN_BYTES:
+		srv->rates.conn_bytes = va_arg(va, double);
+		break;
+	case MEMCACHED_OPT_USER_OPS:
+		srv->rates.user_ops = va_arg(va, double);
+		break;
+	case MEMCACHED_OPT_USER_BYTES:
+		srv->rates.user_bytes = va_arg(va, double);
+		break;
+	case MEMCACHED_OPT_SHED_LAG:
+		srv->overload.max_lag = va_arg(va, double);
+		if (!srv->running)
+			break;
+		if (srv->overload.max_lag > 0)
+			memcached_overload_start(srv);
+		else
+			memcached_overload_stop(srv);
+		break;
+	case MEMCACHED_OPT_PRIORITY: {
+		const char *name = va_arg(va, const char *);
+		enum memcached_priority prio = memcached_priority_parse(name);
+		if (prio == MEMCACHED_PRIORITY_MAX) {
+			say_error("Bad priority class '%s'", name);
+			return;
+		}
+		srv->priority = prio;
+		break;
+	}
+	case MEMCACHED_OPT_SHED_DELAY:
+		srv->overload.max_delay = va_arg(va, double);
+		break;
+	case MEMCACHED_OPT_ASYNC_QUEUE: {
+		uint32_t limit = (uint32_t )va_arg(va, double);
+		if (memcached_coalesce_of(srv) != NULL)
+			memcached_coalesce_set_async(srv->coalesce, -1, limit);
+		break;
+	}
 	default:
 		say_error("No such option %d", opt);
 		break;
@@ -11,9 +11,19 @@
 
 
 #include <small/obuf.h>
+#include <small/region.h>
 #include "constants.h"
+#include "ratelimit.h"
+#include "overload.h"
+#include "priority.h"
+#include "admission.h"
+#include "sliding.h"
 
 struct memcached_connection;
+struct memcached_proxy;
+struct memcached_coalesce;
+struct memcached_user_limit;
+struct proxy_client;
 
 #if defined(__cplusplus)
 extern "C" {
@@ -65,14 +75,85 @@ struct memcached_stat {
 	/* authentication stats */
 	uint64_t      auth_cmds;
 	uint64_t      auth_errors;
+	/* read only replica stats */
+	uint64_t      read_only_rejects;
+	/* proxy stats */
+	uint64_t      proxy_forwarded;
+	uint64_t      proxy_errors;
+	uint64_t      proxy_hot_reads;
+	uint64_t      proxy_hot_copies;
+	/* vbucket stats */
+	uint64_t      vbucket_rejects;
+	/* sets of the stored value, that updated only metadata */
+	uint64_t      set_unchanged;
+	/* sets, replaced in write coalescing buffer by later ones */
+	uint64_t      set_coalesced;
+	/* buffered sets, that failed to be written */
+	uint64_t      async_errors;
+	/* items, evicted to keep tenants within quotas */
+	uint64_t      tenant_evictions;
+	/* delays of reads by rate limits */
+	uint64_t      throttled;
+	uint64_t      throttled_usec;
+	/* overload shedding stats */
+	uint64_t      shed_busy;
+	uint64_t      shed_dropped;
+	uint64_t      loop_lag_usec;
+	/* priority classes stats */
+	uint64_t      priority_yields;
+	/* expiration controller stats */
+	uint64_t      expire_pace;
+	uint64_t      expire_speedups;
+	uint64_t      expire_backoffs;
+	uint64_t      expire_sampled;
+	/* admission stats */
+	uint64_t      admission_accesses;
+	uint64_t      admission_admitted;
+	uint64_t      admission_rejected;
+	/* sliding TTL stats */
+	uint64_t      sliding_touches;
+	/* scratch memory stats */
+	uint64_t      scratch_bytes;
+	uint64_t      scratch_peak;
+	/* sets with the value used in the input buffer */
+	uint64_t      set_inplace;
+};
+
+/* Part of key space, stored in its own space */
+enum memcached_eviction {
+	MEMCACHED_EVICTION_RANDOM = 0x00,
+	MEMCACHED_EVICTION_GDSF   = 0x01
+};
+
+enum memcached_expire_strategy {
+	MEMCACHED_EXPIRE_SCAN   = 0x00,
+	MEMCACHED_EXPIRE_SAMPLE = 0x01
+};
+
+struct memcached_partition {
+	uint32_t      space_id;
+	struct fiber *expire_fiber;
+	uint64_t      evictions;
+	/* tenant partition gets keys with the prefix, NULL if hashed */
+	char         *name;
+	char         *prefix;
+	uint32_t      prefix_len;
+	/* memory quota (0 is unlimited) and estimate of used memory */
+	uint64_t      quota;
+	uint64_t      bytes;
+	/* tenant stats */
+	uint64_t      quota_evictions;
+	uint64_t      get_hits;
+	uint64_t      get_misses;
 };
 
 struct memcached_service {
 	/* expiration configuration */
-	struct fiber *expire_fiber;
 	bool          expire_enabled;
 	int           expire_count;
 	uint32_t      expire_time;
+	bool          expire_adaptive;
+	enum memcached_expire_strategy expire_strategy;
 	/* flush */
 	bool          flush_enabled;
 	int           batch_count;
@@ -80,8 +161,39 @@ struct memcached_service {
 	int           readahead;
 	const char   *uri;
 	const char   *name;
-	uint32_t      space_id;
+	/* key space is split into partitions by key hash */
+	struct memcached_partition *partitions;
+	uint32_t      partition_count;
+	/* keys are hashed among first partitions, tenants follow them */
+	uint32_t      hash_count;
 	bool          sasl;
+	/* replica mode, writes are rejected with reference to master */
+	bool          read_only;
+	char         *master;
+	/* proxy mode, requests are routed to backends */
+	struct memcached_proxy *proxy;
+	/* state of every vbucket, NULL if vbuckets are disabled */
+	uint8_t      *vbuckets;
+	uint32_t      vbucket_count;
+	/* sets, that aren't written to the space yet, NULL if disabled */
+	struct memcached_coalesce *coalesce;
+	/* rate limits and buckets of SASL users */
+	struct memcached_rates rates;
+	struct memcached_user_limit *user_limits;
+	/* load shedding */
+	struct memcached_overload overload;
+	/* priority classes */
+	enum memcached_priority priority;
+	struct memcached_user_priority *user_priorities;
+	/* admission of new items to full tenants and eviction policy */
+	enum memcached_admission_mode admission_mode;
+	enum memcached_eviction eviction;
+	struct memcached_admission *admission;
+	/* items with the flag live for their TTL since the last read */
+	uint32_t      sliding_flag;
+	struct memcached_sliding *sliding;
+	/* background fibers are started */
+	bool          running;
 	/* properties */
 	uint64_t      cas;
 	uint64_t      flush;
@@ -112,6 +224,8 @@ struct memcached_connection {
 	struct ibuf              *in;
 	struct obuf              *out;
 	struct obuf_svp           write_end;
+	/* scratch memory of requests, it's reset after every batch */
+	struct region             scratch;
 	bool                      noreply;
 	bool                      noprocess;
 	bool                      close_connection;
@@ -124,6 +238,17 @@ struct memcached_connection {
 //	struct session           *session;
 	struct sasl_ctx          *sasl_ctx;
 	int                       authentication_step;
+	/* requests, forwarded to backends in proxy mode */
+	struct proxy_client      *proxy;
+	/* partition of the last key, that was looked up */
+	struct memcached_partition *part;
+	/* rate limit buckets of the connection and its SASL user */
+	struct memcached_limit    limit;
+	struct memcached_user_limit *user_limit;
+	/* time of the last read, requests wait since it */
+	double                    read_time;
+	enum memcached_priority   priority;
+	bool                      prio_pending;
 	union {
 		/* request data (binary) */
 		struct {
@@ -156,6 +281,26 @@ void memcached_free(struct memcached_service *);
 
 void memcached_handler(struct memcached_service *p, int fd);
 
+int  memcached_purge(struct memcached_service *);
+
+int  memcached_sync(struct memcached_service *);
+
+int  memcached_stream(struct memcached_connection *con);
+
+void memcached_cas_observe(struct memcached_service *, uint64_t cas);
+
+uint64_t memcached_flush_time(struct memcached_service *);
+
+int  memcached_set_partitions(struct memcached_service *, uint32_t count,
+			      uint32_t tenants, const uint32_t *space_ids);
+
+uint32_t memcached_space_of(struct memcached_service *, const char *key,
+			    uint32_t key_len);
+
+int  memcached_set_tenant(struct memcached_service *, uint32_t i,
+			  const char *name, const char *prefix,
+			  uint64_t quota, uint64_t bytes);
+
 
 /* options */
 enum memcached_options {
@@ -167,6 +312,30 @@ enum memcached_options {
 	MEMCACHED_OPT_VERBOSITY      = 0x05,
 	MEMCACHED_OPT_PROTOCOL       = 0x06,
 	MEMCACHED_OPT_SASL           = 0x07,
+	MEMCACHED_OPT_READ_ONLY      = 0x08,
+	MEMCACHED_OPT_MASTER         = 0x09,
+	MEMCACHED_OPT_PROXY          = 0x0A,
+	MEMCACHED_OPT_PROXY_CONNS    = 0x0B,
+	MEMCACHED_OPT_PROXY_TIMEOUT  = 0x0C,
+	MEMCACHED_OPT_HOT_REPLICAS   = 0x0D,
+	MEMCACHED_OPT_HOT_THRESHOLD  = 0x0E,
+	MEMCACHED_OPT_HOT_TTL        = 0x0F,
+	MEMCACHED_OPT_VBUCKETS       = 0x10,
+	MEMCACHED_OPT_COALESCE       = 0x11,
+	MEMCACHED_OPT_ASYNC_WRITERS  = 0x12,
+	MEMCACHED_OPT_ASYNC_QUEUE    = 0x13,
+	MEMCACHED_OPT_CONN_OPS       = 0x14,
+	MEMCACHED_OPT_CONN_BYTES     = 0x15,
+	MEMCACHED_OPT_USER_OPS       = 0x16,
+	MEMCACHED_OPT_USER_BYTES     = 0x17,
+	MEMCACHED_OPT_SHED_LAG       = 0x18,
+	MEMCACHED_OPT_SHED_DELAY     = 0x19,
+	MEMCACHED_OPT_PRIORITY       = 0x1A,
+	MEMCACHED_OPT_EXPIRE_ADAPTIVE = 0x1B,
+	MEMCACHED_OPT_EXPIRE_STRATEGY = 0x1C,
+	MEMCACHED_OPT_ADMISSION      = 0x1D,
+	MEMCACHED_OPT_EVICTION       = 0x1E,
+	MEMCACHED_OPT_SLIDING_FLAG   = 0x1F,
 	MEMCACHED_OPT_MAX
 };
 
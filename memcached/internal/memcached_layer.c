@@ -7,16 +7,21 @@
 #include <ctype.h>
 #include <math.h>
 #include <unistd.h>
+#include <stdlib.h>
 
 #include <tarantool/module.h>
 
 #include <msgpuck.h>
+#include <small/ibuf.h>
 #include <small/obuf.h>
 
 #include "error.h"
 #include "memcached.h"
 #include "memcached_layer.h"
 #include "utils.h"
+#include "coalesce.h"
+#include "admission.h"
+#include "sliding.h"
 /*
  * default exptime is 30*24*60*60 seconds
  * \* 1000000 to convert it to usec (need this precision)
@@ -46,6 +51,23 @@ is_expired (uint64_t exptime, uint64_t time, uint64_t flush)
 	return 0;
 }
 
+/* Item with sliding TTL lives for its TTL since the last read */
+static inline uint64_t
+sliding_exptime(struct memcached_service *p, box_tuple_t *tuple,
+		uint64_t exptime, uint64_t time)
+{
+	const char *pos = box_tuple_field(tuple, 5);
+	if ((mp_decode_uint(&pos) & p->sliding_flag) == 0)
+		return exptime;
+	uint32_t klen = 0;
+	const char *kpos = box_tuple_field(tuple, 0);
+	            kpos = mp_decode_str(&kpos, &klen);
+	uint64_t last = memcached_sliding_last(p->sliding, kpos, klen);
+	if (last <= time)
+		return exptime;
+	return last + (exptime - time);
+}
+
 int
 is_expired_tuple(struct memcached_service *p, box_tuple_t *tuple)
 {
@@ -53,17 +75,382 @@ is_expired_tuple(struct memcached_service *p, box_tuple_t *tuple)
 	const char *pos  = box_tuple_field(tuple, 1);
 	uint64_t exptime = mp_decode_uint(&pos);
 	uint64_t time    = mp_decode_uint(&pos);
+	if (p->sliding != NULL && p->sliding_flag != 0 &&
+	    exptime != INF_EXPTIME && exptime > time)
+		exptime = sliding_exptime(p, tuple, exptime, time);
 	return is_expired(exptime, time, flush);
 }
 
-int
-memcached_tuple_set(struct memcached_connection *con,
-		    const char *kpos, uint32_t klen, uint64_t expire,
-		    const char *vpos, uint32_t vlen, uint64_t cas,
-		    uint32_t flags)
+/**
+ * Read of the item: item with sliding TTL remembers the time in module
+ * memory, so the tuple isn't written.
+ */
+void
+memcached_tuple_touch(struct memcached_service *p, box_tuple_t *tuple)
+{
+	if (p->sliding == NULL || p->sliding_flag == 0)
+		return;
+	const char *pos = box_tuple_field(tuple, 5);
+	if ((mp_decode_uint(&pos) & p->sliding_flag) == 0)
+		return;
+	uint32_t klen = 0;
+	const char *kpos = box_tuple_field(tuple, 0);
+	            kpos = mp_decode_str(&kpos, &klen);
+	memcached_sliding_touch(p->sliding, kpos, klen, fiber_time64());
+	p->stat.sliding_touches++;
+}
+
+/* values from this size are compared with the stored one on set */
+#define SET_REFRESH_MIN 512
+/* encoded keys up to this size are built on stack */
+#define KEY_STACK_SIZE 320
+/* scratch memory above this size is returned to slab cache on reset */
+#define SCRATCH_KEEP (64 * 1024)
+
+/**
+ * Memory for keys, tuples and update operations of a request, it lives
+ * till the end of the batch. Unlike box_txn_alloc() it's released, when
+ * there's no transaction.
+ */
+void *
+memcached_scratch_alloc(struct memcached_connection *con, size_t size,
+			const char *what)
+{
+	void *ptr = region_alloc(&con->scratch, size);
+	if (ptr == NULL) {
+		memcached_error_ENOMEM(size, what);
+		return NULL;
+	}
+	con->cfg->stat.scratch_bytes += size;
+	return ptr;
+}
+
+/* Batch is over: release scratch memory and note its high-water mark */
+void
+memcached_scratch_reset(struct memcached_connection *con)
+{
+	size_t used = region_used(&con->scratch);
+	if (used == 0)
+		return;
+	if (used > con->cfg->stat.scratch_peak)
+		con->cfg->stat.scratch_peak = used;
+	if (region_total(&con->scratch) > SCRATCH_KEEP)
+		region_free(&con->scratch);
+	else
+		region_truncate(&con->scratch, 0);
+}
+
+/* count of items, evicted by a set, that exceeds the tenant's quota */
+#define TENANT_EVICT_MAX 16
+/* count of random items, the GDSF victim is chosen from */
+#define GDSF_SAMPLES 5
+
+/**
+ * Partition of the key. Keys with tenant's prefix go to its partition,
+ * others are hashed. Mapping is the same as for vbuckets, so with
+ * equal counts every vbucket is stored in its own space.
+ */
+struct memcached_partition *
+memcached_partition_of(struct memcached_service *p, const char *key,
+		       uint32_t key_len)
+{
+	struct memcached_partition *part = &p->partitions[p->hash_count];
+	struct memcached_partition *end  = &p->partitions[p->partition_count];
+	for (; part < end; ++part) {
+		if (key_len >= part->prefix_len &&
+		    memcmp(key, part->prefix, part->prefix_len) == 0)
+			return part;
+	}
+	if (p->hash_count == 1)
+		return &p->partitions[0];
+	uint32_t crc = memcached_crc32(key, key_len);
+	return &p->partitions[((crc >> 16) & 0x7fff) % p->hash_count];
+}
+
+static inline void
+memcached_partition_resize(struct memcached_partition *part, size_t added,
+			   box_tuple_t *removed)
+{
+	part->bytes += added;
+	if (removed == NULL)
+		return;
+	size_t size = box_tuple_bsize(removed);
+	part->bytes -= (size < part->bytes ? size : part->bytes);
+}
+
+/**
+ * GDSF value of an item: frequency * cost / size, where frequency is
+ * estimated by the aging sketch of accesses, so it's recent, and cost
+ * is a hint in the high byte of flags.
+ */
+static double
+memcached_gdsf_value(struct memcached_service *p, box_tuple_t *tuple)
+{
+	uint32_t klen = 0;
+	const char *kpos = box_tuple_field(tuple, 0);
+	            kpos = mp_decode_str(&kpos, &klen);
+	const char *pos  = box_tuple_field(tuple, 5);
+	uint64_t flags   = mp_decode_uint(&pos);
+	double cost = 1 + ((flags >> 24) & 0xff);
+	double freq = 1 + memcached_admission_estimate(p->admission, kpos,
+						       klen);
+	return freq * cost / box_tuple_bsize(tuple);
+}
+
+/**
+ * Victim of eviction: a random item, or the one with the least GDSF
+ * value among a few random items.
+ */
+static int
+memcached_partition_victim(struct memcached_service *p,
+			   struct memcached_partition *part,
+			   box_tuple_t **victim)
+{
+	if (box_index_random(part->space_id, 0, rand(), victim) == -1)
+		return -1;
+	if (*victim == NULL || p->eviction != MEMCACHED_EVICTION_GDSF ||
+	    p->admission == NULL)
+		return 0;
+	double value = memcached_gdsf_value(p, *victim);
+	for (int i = 1; i < GDSF_SAMPLES; ++i) {
+		box_tuple_t *tuple = NULL;
+		if (box_index_random(part->space_id, 0, rand(), &tuple) == -1)
+			return -1;
+		if (tuple == NULL)
+			break;
+		double v = memcached_gdsf_value(p, tuple);
+		if (v < value) {
+			value = v;
+			*victim = tuple;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Admission of a new key, when the partition is full: it must be
+ * accessed more often, than the key of the first victim. Updates of
+ * stored keys are always admitted.
+ *
+ * \returns 0 if admitted, 1 if the set must be dropped, -1 on error
+ */
+static int
+memcached_partition_admit(struct memcached_connection *con,
+			  struct memcached_partition *part,
+			  const char *key, uint32_t key_len,
+			  const char *victim, uint32_t victim_len,
+			  const char *begin, const char *end)
+{
+	struct memcached_service *p = con->cfg;
+	if (p->admission_mode == MEMCACHED_ADMISSION_OFF ||
+	    p->admission == NULL)
+		return 0;
+	box_tuple_t *tuple = NULL;
+	if (box_index_get(part->space_id, 0, begin, end, &tuple) == -1)
+		return -1;
+	if (tuple != NULL || memcached_admission_admit(p->admission, key,
+				key_len, victim, victim_len)) {
+		p->stat.admission_admitted++;
+		return 0;
+	}
+	p->stat.admission_rejected++;
+	if (p->admission_mode == MEMCACHED_ADMISSION_ACCEPT)
+		return 1;
+	memcached_set_errcode(con, MEMCACHED_RES_NOT_STORED);
+	return -1;
+}
+
+/**
+ * Make room for 'size' bytes in the partition with quota: random items
+ * are evicted, while the quota is exceeded. Memory usage is an
+ * estimate, it's recounted by every pass of expiration fiber.
+ *
+ * \returns 0 on success, 1 if the set isn't admitted and must be
+ *          dropped, -1 on error
+ */
+static int
+memcached_partition_reserve(struct memcached_connection *con,
+			    struct memcached_partition *part,
+			    const char *key, uint32_t key_len, size_t size)
+{
+	if (size > part->quota) {
+		memcached_error(MEMCACHED_RES_E2BIG);
+		return -1;
+	}
+	for (int i = 0; i < TENANT_EVICT_MAX &&
+			part->bytes + size > part->quota; ++i) {
+		box_tuple_t *victim = NULL;
+		if (memcached_partition_victim(con->cfg, part, &victim) == -1)
+			return -1;
+		if (victim == NULL) {
+			/* space is empty, estimate is stale */
+			part->bytes = 0;
+			break;
+		}
+		uint32_t klen = 0;
+		const char *kpos = box_tuple_field(victim, 0);
+		            kpos = mp_decode_str(&kpos, &klen);
+		uint32_t len = mp_sizeof_array(1) + mp_sizeof_str(klen);
+		char *begin  = (char *)memcached_scratch_alloc(con, len, "key");
+		if (begin == NULL)
+			return -1;
+		char *end = mp_encode_array(begin, 1);
+		      end = mp_encode_str  (end, kpos, klen);
+		if (i == 0) {
+			uint32_t new_len = mp_sizeof_array(1) +
+					   mp_sizeof_str(key_len);
+			char *new_begin = (char *)
+				memcached_scratch_alloc(con, new_len, "key");
+			if (new_begin == NULL)
+				return -1;
+			char *new_end = mp_encode_array(new_begin, 1);
+			      new_end = mp_encode_str  (new_end, key, key_len);
+			int rc = memcached_partition_admit(con, part, key,
+					key_len, kpos, klen, new_begin, new_end);
+			if (rc != 0)
+				return rc;
+		}
+		box_tuple_t *old = NULL;
+		if (box_delete(part->space_id, 0, begin, end, &old) == -1)
+			return -1;
+		memcached_partition_resize(part, 0, old);
+		part->quota_evictions++;
+		con->cfg->stat.tenant_evictions++;
+	}
+	return 0;
+}
+
+box_iterator_t *
+memcached_partition_iterator(struct memcached_service *p, uint32_t part)
+{
+	char key[2], *key_end = mp_encode_array(key, 0);
+	return box_index_iterator(p->partitions[part].space_id, 0, ITER_ALL,
+				  key, key_end);
+}
+
+/* Set is buffered by coalescing or asynchronous writes */
+static inline bool
+memcached_tuple_buffered(struct memcached_connection *con)
+{
+	struct memcached_coalesce *c = con->cfg->coalesce;
+	return memcached_coalesce_enabled(c) ||
+	       (con->noreply && memcached_coalesce_async(c));
+}
+
+/**
+ * Store the tuple, that is encoded in 'begin'..'end', or buffer it.
+ * With 'insert' the key must not exist, such sets aren't buffered.
+ *
+ * \returns 0 on success, 1 if the set isn't admitted and is dropped,
+ *          -1 on error
+ */
+static int
+memcached_tuple_store(struct memcached_connection *con,
+		      struct memcached_partition *part,
+		      const char *kpos, uint32_t klen,
+		      const char *begin, const char *end, bool insert)
+{
+	if (part->quota > 0) {
+		int rc = memcached_partition_reserve(con, part, kpos, klen,
+						     end - begin);
+		if (rc != 0)
+			return rc;
+	}
+	if (insert) {
+		if (box_insert(part->space_id, begin, end, NULL) == -1)
+			return -1;
+		memcached_partition_resize(part, end - begin, NULL);
+		return 0;
+	}
+	if (memcached_tuple_buffered(con)) {
+		/* replaced item isn't known, usage is overestimated */
+		memcached_partition_resize(part, end - begin, NULL);
+		return memcached_coalesce_put(con->cfg->coalesce,
+					      part->space_id, kpos, klen,
+					      begin, end);
+	}
+	memcached_coalesce_drop(con->cfg->coalesce, kpos, klen);
+	box_tuple_t *old = NULL;
+	if (box_replace(part->space_id, begin, end, &old) == -1)
+		return -1;
+	memcached_partition_resize(part, end - begin, old);
+	return 0;
+}
+
+/* the most of bytes around the value, that are saved for in-place set */
+#define INPLACE_HEAD_MAX KEY_STACK_SIZE
+#define INPLACE_TAIL_MAX 16
+
+/**
+ * Set with the value, that is in the input buffer: the tuple is encoded
+ * around the value, over the request header (and processed requests)
+ * before it and over next bytes after it, so the value isn't copied
+ * before box copies it into the tuple. Overwritten bytes are saved and
+ * restored then.
+ *
+ * \returns 1 if the value can't be used in place
+ */
+static int
+memcached_tuple_set_inplace(struct memcached_connection *con,
+			    const char *kpos, uint32_t klen, uint64_t expire,
+			    const char *vpos, uint32_t vlen, uint64_t cas,
+			    uint32_t flags, uint64_t time, bool insert)
+{
+	struct ibuf *in = con->in;
+	uint32_t head_len = mp_sizeof_array(6)      +
+			    mp_sizeof_str  (klen)   +
+			    mp_sizeof_uint (expire) +
+			    mp_sizeof_uint (time)   +
+			    mp_sizeof_strl (vlen);
+	uint32_t tail_len = mp_sizeof_uint(cas) + mp_sizeof_uint(flags);
+	if (in == NULL || vpos < in->buf + head_len ||
+	    vpos + vlen + tail_len > in->end ||
+	    head_len > INPLACE_HEAD_MAX)
+		return 1;
+	char *begin = (char *)vpos - head_len;
+	char *tail  = (char *)vpos + vlen;
+	char head_saved[INPLACE_HEAD_MAX], tail_saved[INPLACE_TAIL_MAX];
+	memcpy(head_saved, begin, head_len);
+	memcpy(tail_saved, tail, tail_len);
+	/* the key may be in the head, so it's moved to its place before the
+	 * header is encoded over the bytes, it took */
+	char *key = begin + mp_sizeof_array(6) + mp_sizeof_strl(klen);
+	memmove(key, kpos, klen);
+	char *end = mp_encode_array(begin, 6);
+	      end = mp_encode_strl (end, klen);
+	assert(end == key);
+	      end = key + klen;
+	      end = mp_encode_uint (end, expire);
+	      end = mp_encode_uint (end, time);
+	      end = mp_encode_strl (end, vlen);
+	assert(end == vpos);
+	      end = mp_encode_uint (tail, cas);
+	      end = mp_encode_uint (end, flags);
+	struct memcached_partition *part = memcached_partition_of(con->cfg,
+								  key, klen);
+	int rc = memcached_tuple_store(con, part, key, klen, begin, end,
+				       insert);
+	memcpy(begin, head_saved, head_len);
+	memcpy(tail, tail_saved, tail_len);
+	/* dropped by admission, it's not an error, but nothing is stored */
+	if (rc == 1)
+		return 0;
+	if (rc == 0)
+		con->cfg->stat.set_inplace++;
+	return rc;
+}
+
+static int
+memcached_tuple_write(struct memcached_connection *con,
+		      const char *kpos, uint32_t klen, uint64_t expire,
+		      const char *vpos, uint32_t vlen, uint64_t cas,
+		      uint32_t flags, bool insert)
 {
-	(void )con;
 	uint64_t time = fiber_time64();
+	int rc = memcached_tuple_set_inplace(con, kpos, klen, expire, vpos,
+					     vlen, cas, flags, time, insert);
+	if (rc != 1)
+		return rc;
 	uint32_t len = mp_sizeof_array(6)      +
 		       mp_sizeof_str  (klen)   +
 		       mp_sizeof_uint (expire) +
@@ -71,11 +458,9 @@ memcached_tuple_set(struct memcached_connection *con,
 		       mp_sizeof_str  (vlen)   +
 		       mp_sizeof_uint (cas)    +
 		       mp_sizeof_uint (flags);
-	char *begin  = (char *)box_txn_alloc(len);
-	if (begin == NULL) {
-		memcached_error_ENOMEM(len, "tuple");
+	char *begin  = (char *)memcached_scratch_alloc(con, len, "tuple");
+	if (begin == NULL)
 		return -1;
-	}
 	char *end = mp_encode_array(begin, 6);
 	      end = mp_encode_str  (end, kpos, klen);
 	      end = mp_encode_uint (end, expire);
@@ -84,7 +469,165 @@ memcached_tuple_set(struct memcached_connection *con,
 	      end = mp_encode_uint (end, cas);
 	      end = mp_encode_uint (end, flags);
 	assert(end <= begin + len);
-	return box_replace(con->cfg->space_id, begin, end, NULL);
+	struct memcached_partition *part = memcached_partition_of(con->cfg,
+								  kpos, klen);
+	rc = memcached_tuple_store(con, part, kpos, klen, begin, end, insert);
+	return (rc == 1 ? 0 : rc);
+}
+
+int
+memcached_tuple_set(struct memcached_connection *con,
+		    const char *kpos, uint32_t klen, uint64_t expire,
+		    const char *vpos, uint32_t vlen, uint64_t cas,
+		    uint32_t flags)
+{
+	return memcached_tuple_write(con, kpos, klen, expire, vpos, vlen,
+				     cas, flags, false);
+}
+
+/**
+ * Set without reading the stored item first: the hash index is probed
+ * once by replace, and the replaced tuple, that it returns, corrects
+ * memory usage of the partition. Values from SET_REFRESH_MIN are read
+ * first, to be compared with the stored one, see memcached_tuple_refresh():
+ * a metadata-only write saves the most for them.
+ */
+bool
+memcached_tuple_blind(uint32_t vlen)
+{
+	return vlen < SET_REFRESH_MIN;
+}
+
+/**
+ * Add with a single probe: insert fails, if the key exists, and only
+ * then the stored item is read, to be reclaimed if it's expired. Sets,
+ * that are buffered, can't be inserted, and a tenant with quota evicts
+ * items for the new one before it's written, so in both cases the
+ * stored item is read first.
+ *
+ * \returns 0 on success, 1 if the item exists, -1 on error
+ */
+int
+memcached_tuple_add(struct memcached_connection *con,
+		    const char *kpos, uint32_t klen, uint64_t expire,
+		    const char *vpos, uint32_t vlen, uint64_t cas,
+		    uint32_t flags)
+{
+	box_tuple_t *tuple = NULL;
+	struct memcached_coalesce *c = con->cfg->coalesce;
+	struct memcached_partition *part = memcached_partition_of(con->cfg,
+								  kpos, klen);
+	if (memcached_tuple_buffered(con) || part->quota > 0 ||
+	    memcached_coalesce_get(c, kpos, klen) != NULL) {
+		if (memcached_tuple_get(con, kpos, klen, &tuple) == -1)
+			return -1;
+	} else {
+		if (memcached_tuple_write(con, kpos, klen, expire, vpos, vlen,
+					  cas, flags, true) == 0)
+			return 0;
+		const box_error_t *err = box_error_last();
+		if (err == NULL ||
+		    box_error_code(err) != ER_TUPLE_FOUND)
+			return -1;
+		box_error_clear();
+		if (memcached_tuple_get(con, kpos, klen, &tuple) == -1)
+			return -1;
+	}
+	if (tuple != NULL) {
+		if (!is_expired_tuple(con->cfg, tuple))
+			return 1;
+		con->cfg->stat.reclaimed++;
+	}
+	return memcached_tuple_set(con, kpos, klen, expire, vpos, vlen, cas,
+				   flags);
+}
+
+/**
+ * True if the value of the tuple is the same as new one. Length is
+ * compared first, so different values are rarely compared byte by byte.
+ */
+bool
+memcached_tuple_same_value(box_tuple_t *tuple, const char *vpos,
+			   uint32_t vlen)
+{
+	uint32_t len = 0;
+	const char *pos = box_tuple_field(tuple, 3);
+	const char *val = mp_decode_str(&pos, &len);
+	return len == vlen && memcmp(val, vpos, vlen) == 0;
+}
+
+/**
+ * Set of the value, that is already stored: update everything, but the
+ * value, so the WAL gets a small update instead of the whole tuple.
+ */
+int
+memcached_tuple_refresh(struct memcached_connection *con,
+			const char *kpos, uint32_t klen, uint64_t expire,
+			uint64_t cas, uint32_t flags)
+{
+	/* Buffered sets are cheap, the last one is written anyway */
+	if (memcached_tuple_buffered(con) ||
+	    memcached_coalesce_get(con->cfg->coalesce, kpos, klen) != NULL) {
+		box_tuple_t *tuple = NULL;
+		if (memcached_tuple_get(con, kpos, klen, &tuple) == -1)
+			return -1;
+		assert(tuple != NULL);
+		uint32_t vlen = 0;
+		const char *pos  = box_tuple_field(tuple, 3);
+		const char *vpos = mp_decode_str(&pos, &vlen);
+		return memcached_tuple_set(con, kpos, klen, expire, vpos, vlen,
+					   cas, flags);
+	}
+	uint64_t time = fiber_time64();
+	uint32_t key_len = mp_sizeof_array(1) + mp_sizeof_str(klen);
+	uint32_t ops_len = mp_sizeof_array(4) +
+			   4 * (mp_sizeof_array(3) + mp_sizeof_str(1) +
+				mp_sizeof_uint(5)) +
+			   mp_sizeof_uint(expire) + mp_sizeof_uint(time) +
+			   mp_sizeof_uint(cas)    + mp_sizeof_uint(flags);
+	char *begin = (char *)memcached_scratch_alloc(con, key_len + ops_len,
+						      "update");
+	if (begin == NULL)
+		return -1;
+	char *key_end = mp_encode_array(begin, 1);
+	      key_end = mp_encode_str  (key_end, kpos, klen);
+	char *end = mp_encode_array(key_end, 4);
+	      end = mp_encode_array(end, 3);
+	      end = mp_encode_str  (end, "=", 1);
+	      end = mp_encode_uint (end, 1);
+	      end = mp_encode_uint (end, expire);
+	      end = mp_encode_array(end, 3);
+	      end = mp_encode_str  (end, "=", 1);
+	      end = mp_encode_uint (end, 2);
+	      end = mp_encode_uint (end, time);
+	      end = mp_encode_array(end, 3);
+	      end = mp_encode_str  (end, "=", 1);
+	      end = mp_encode_uint (end, 4);
+	      end = mp_encode_uint (end, cas);
+	      end = mp_encode_array(end, 3);
+	      end = mp_encode_str  (end, "=", 1);
+	      end = mp_encode_uint (end, 5);
+	      end = mp_encode_uint (end, flags);
+	assert(end <= begin + key_len + ops_len);
+	struct memcached_partition *part = memcached_partition_of(con->cfg,
+								  kpos, klen);
+	return box_update(part->space_id, 0, begin, key_end, key_end, end,
+			  0, NULL);
+}
+
+/**
+ * Count access of the key by admission and GDSF eviction. Command
+ * handlers call it once for every key of a request, so the key of a set,
+ * that reads the stored item first, isn't counted twice.
+ */
+void
+memcached_tuple_access(struct memcached_connection *con,
+		       const char *key, uint32_t key_len)
+{
+	if (con->cfg->admission == NULL)
+		return;
+	memcached_admission_record(con->cfg->admission, key, key_len);
+	con->cfg->stat.admission_accesses++;
 }
 
 int
@@ -93,25 +636,58 @@ memcached_tuple_get(struct memcached_connection *con,
 		    box_tuple_t **tuple)
 {
 	/* Create key for getting previous tuple from space */
+	char buf[KEY_STACK_SIZE];
 	uint32_t len = mp_sizeof_array(1) +
 		       mp_sizeof_str  (key_len);
-	char *begin  = (char *)box_txn_alloc(len);
-	if (begin == NULL) {
-		memcached_error_ENOMEM(len, "key");
+	char *begin  = buf;
+	if (len > KEY_STACK_SIZE &&
+	    (begin = (char *)memcached_scratch_alloc(con, len, "key")) == NULL)
 		return -1;
-	}
 	char *end = NULL;
 	end = mp_encode_array(begin, 1);
 	end = mp_encode_str  (end, key, key_len);
 	assert(end <= begin + len);
 
+	struct memcached_partition *part = memcached_partition_of(con->cfg,
+								  key, key_len);
+	con->part = part;
+
+	/* Set, that isn't written yet, is the latest value */
+	*tuple = memcached_coalesce_get(con->cfg->coalesce, key, key_len);
+	if (*tuple != NULL)
+		return 0;
+
 	/* Get tuple from space */
-	if (box_index_get(con->cfg->space_id, 0, begin, end, tuple) == -1) {
+	if (box_index_get(part->space_id, 0, begin, end, tuple) == -1) {
 		return -1;
 	}
 	return 0;
 }
 
+int
+memcached_tuple_delete(struct memcached_connection *con,
+		       const char *key, uint32_t key_len,
+		       box_tuple_t **tuple)
+{
+	uint32_t len = mp_sizeof_array(1) +
+		       mp_sizeof_str  (key_len);
+	char *begin  = (char *)memcached_scratch_alloc(con, len, "key");
+	if (begin == NULL)
+		return -1;
+	char *end = mp_encode_array(begin, 1);
+	      end = mp_encode_str  (end, key, key_len);
+	assert(end <= begin + len);
+	/* Pending set is written first, so delete returns it */
+	if (memcached_coalesce_write(con->cfg->coalesce, key, key_len) == -1)
+		return -1;
+	struct memcached_partition *part = memcached_partition_of(con->cfg,
+								  key, key_len);
+	if (box_delete(part->space_id, 0, begin, end, tuple) == -1)
+		return -1;
+	memcached_partition_resize(part, 0, *tuple);
+	return 0;
+}
+
 #define _stat_append(_con, _key, _val, ...)				\
 	if (stat_append((_con), (_key), (_val), ##__VA_ARGS__) == -1) {	\
 		return -1;						\
@@ -163,6 +739,92 @@ memcached_stat_all(struct memcached_connection *con,
 	_stat_append(con, "reclaimed",     "%lu", con->cfg->stat.reclaimed);
 	_stat_append(con, "auth_cmds",     "%lu", con->cfg->stat.auth_cmds);
 	_stat_append(con, "auth_errors",   "%lu", con->cfg->stat.auth_errors);
+	_stat_append(con, "read_only_rejects", "%lu",
+		     con->cfg->stat.read_only_rejects);
+	_stat_append(con, "proxy_forwarded", "%lu",
+		     con->cfg->stat.proxy_forwarded);
+	_stat_append(con, "proxy_errors", "%lu",
+		     con->cfg->stat.proxy_errors);
+	_stat_append(con, "proxy_hot_reads", "%lu",
+		     con->cfg->stat.proxy_hot_reads);
+	_stat_append(con, "proxy_hot_copies", "%lu",
+		     con->cfg->stat.proxy_hot_copies);
+	_stat_append(con, "vbucket_rejects", "%lu",
+		     con->cfg->stat.vbucket_rejects);
+	_stat_append(con, "set_unchanged", "%lu",
+		     con->cfg->stat.set_unchanged);
+	_stat_append(con, "set_coalesced", "%lu",
+		     con->cfg->stat.set_coalesced);
+	_stat_append(con, "async_errors", "%lu",
+		     con->cfg->stat.async_errors);
+	_stat_append(con, "tenant_evictions", "%lu",
+		     con->cfg->stat.tenant_evictions);
+	_stat_append(con, "throttled", "%lu", con->cfg->stat.throttled);
+	_stat_append(con, "throttled_usec", "%lu",
+		     con->cfg->stat.throttled_usec);
+	_stat_append(con, "shed_busy", "%lu", con->cfg->stat.shed_busy);
+	_stat_append(con, "shed_dropped", "%lu", con->cfg->stat.shed_dropped);
+	_stat_append(con, "loop_lag_usec", "%lu",
+		     con->cfg->stat.loop_lag_usec);
+	_stat_append(con, "priority_yields", "%lu",
+		     con->cfg->stat.priority_yields);
+	_stat_append(con, "expire_pace", "%lu", con->cfg->stat.expire_pace);
+	_stat_append(con, "expire_speedups", "%lu",
+		     con->cfg->stat.expire_speedups);
+	_stat_append(con, "expire_backoffs", "%lu",
+		     con->cfg->stat.expire_backoffs);
+	_stat_append(con, "expire_sampled", "%lu",
+		     con->cfg->stat.expire_sampled);
+	_stat_append(con, "admission_accesses", "%lu",
+		     con->cfg->stat.admission_accesses);
+	_stat_append(con, "admission_admitted", "%lu",
+		     con->cfg->stat.admission_admitted);
+	_stat_append(con, "admission_rejected", "%lu",
+		     con->cfg->stat.admission_rejected);
+	_stat_append(con, "sliding_touches", "%lu",
+		     con->cfg->stat.sliding_touches);
+	_stat_append(con, "scratch_bytes", "%lu",
+		     con->cfg->stat.scratch_bytes);
+	_stat_append(con, "scratch_peak", "%lu", con->cfg->stat.scratch_peak);
+	_stat_append(con, "set_inplace", "%lu", con->cfg->stat.set_inplace);
+	_stat_append(con, NULL, NULL);
+	return 0;
+}
+
+/* 'stats partitions': size and evictions of every partition */
+int
+memcached_stat_partitions(struct memcached_connection *con,
+			  stat_func_t stat_append)
+{
+	struct memcached_service *p = con->cfg;
+	for (uint32_t i = 0; i < p->partition_count; ++i) {
+		char name[32];
+		snprintf(name, 32, "part_%" PRIu32, i);
+		_stat_append(con, name, "items=%zd evictions=%" PRIu64,
+			     box_index_len(p->partitions[i].space_id, 0),
+			     p->partitions[i].evictions);
+	}
+	_stat_append(con, NULL, NULL);
+	return 0;
+}
+
+/* 'stats tenants': usage, quota and hit rate of every tenant */
+int
+memcached_stat_tenants(struct memcached_connection *con,
+		       stat_func_t stat_append)
+{
+	struct memcached_service *p = con->cfg;
+	for (uint32_t i = p->hash_count; i < p->partition_count; ++i) {
+		struct memcached_partition *part = &p->partitions[i];
+		char name[128];
+		snprintf(name, 128, "tenant_%s", part->name);
+		_stat_append(con, name, "prefix=%s items=%zd bytes=%" PRIu64
+			     " quota=%" PRIu64 " get_hits=%" PRIu64
+			     " get_misses=%" PRIu64 " evictions=%" PRIu64,
+			     part->prefix, box_index_len(part->space_id, 0),
+			     part->bytes, part->quota, part->get_hits,
+			     part->get_misses, part->quota_evictions);
+	}
 	_stat_append(con, NULL, NULL);
 	return 0;
 }
@@ -19,12 +19,33 @@ memcached_process_unsupported(struct memcached_connection *con);
 int
 memcached_process_unknown(struct memcached_connection *con);
 
+void *
+memcached_scratch_alloc(struct memcached_connection *con, size_t size,
+			const char *what);
+
+void
+memcached_scratch_reset(struct memcached_connection *con);
+
 uint64_t
 convert_exptime (uint64_t exptime);
 
 int
 is_expired_tuple(struct memcached_service *p, box_tuple_t *tuple);
 
+void
+memcached_tuple_touch(struct memcached_service *p, box_tuple_t *tuple);
+
+struct memcached_partition *
+memcached_partition_of(struct memcached_service *p, const char *key,
+		       uint32_t key_len);
+
+box_iterator_t *
+memcached_partition_iterator(struct memcached_service *p, uint32_t part);
+
+void
+memcached_tuple_access(struct memcached_connection *con,
+		       const char *key, uint32_t key_len);
+
 int
 memcached_tuple_get(struct memcached_connection *con,
 		    const char *key, uint32_t key_len,
@@ -36,6 +57,29 @@ memcached_tuple_set(struct memcached_connection *con,
 		    const char *vpos, uint32_t vlen, uint64_t cas,
 		    uint32_t flags);
 
+bool
+memcached_tuple_blind(uint32_t vlen);
+
+int
+memcached_tuple_add(struct memcached_connection *con,
+		    const char *kpos, uint32_t klen, uint64_t expire,
+		    const char *vpos, uint32_t vlen, uint64_t cas,
+		    uint32_t flags);
+
+bool
+memcached_tuple_same_value(box_tuple_t *tuple, const char *vpos,
+			   uint32_t vlen);
+
+int
+memcached_tuple_refresh(struct memcached_connection *con,
+			const char *kpos, uint32_t klen, uint64_t expire,
+			uint64_t cas, uint32_t flags);
+
+int
+memcached_tuple_delete(struct memcached_connection *con,
+		       const char *key, uint32_t key_len,
+		       box_tuple_t **tuple);
+
 
 
 typedef int (* stat_func_t)(struct memcached_connection *con, const char *key,
@@ -47,4 +91,11 @@ memcached_stat_all(struct memcached_connection *con, stat_func_t append);
 int
 memcached_stat_reset(struct memcached_connection *con, stat_func_t append);
 
+int
+memcached_stat_partitions(struct memcached_connection *con,
+			  stat_func_t append);
+
+int
+memcached_stat_tenants(struct memcached_connection *con, stat_func_t append);
+
 #endif /* MEMCACHED_LAYER_H_INCLUDED */
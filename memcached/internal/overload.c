@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <tarantool/module.h>
+
+#include "memcached.h"
+#include "constants.h"
+#include "error.h"
+#include "overload.h"
+
+/**
+ * Load shedding: when event loop lags or requests wait for too long
+ * since they were read, requests are failed fast with 'busy' error,
+ * instead of being processed late, when the client has given up.
+ */
+
+/* period of the lag monitor */
+#define OVERLOAD_TICK 0.01
+
+static int
+memcached_overload_monitor(va_list ap)
+{
+	struct memcached_service *p = va_arg(ap, struct memcached_service *);
+	struct memcached_overload *o = &p->overload;
+	fiber_set_cancellable(true);
+	while (!fiber_is_cancelled()) {
+		double start = fiber_clock();
+		fiber_sleep(OVERLOAD_TICK);
+		double lag = fiber_clock() - start - OVERLOAD_TICK;
+		if (lag < 0)
+			lag = 0;
+		/* spikes are seen at once, recovery is smoothed */
+		o->lag = (lag > o->lag ? lag : (o->lag + lag) / 2);
+		p->stat.loop_lag_usec = o->lag * 1000000;
+	}
+	return 0;
+}
+
+int
+memcached_overload_start(struct memcached_service *p)
+{
+	struct memcached_overload *o = &p->overload;
+	if (o->max_lag <= 0 || o->monitor != NULL)
+		return 0;
+	char name[128];
+	snprintf(name, 128, "__mc_%s_lag", p->name);
+	o->monitor = fiber_new(name, memcached_overload_monitor);
+	if (o->monitor == NULL) {
+		say_error("Can't start the lag monitor fiber");
+		return -1;
+	}
+	fiber_set_joinable(o->monitor, true);
+	fiber_start(o->monitor, p);
+	return 0;
+}
+
+void
+memcached_overload_stop(struct memcached_service *p)
+{
+	struct memcached_overload *o = &p->overload;
+	if (o->monitor == NULL)
+		return;
+	fiber_cancel(o->monitor);
+	fiber_join(o->monitor);
+	o->monitor = NULL;
+	o->lag = 0;
+	p->stat.loop_lag_usec = 0;
+}
+
+/**
+ * Check, if the request must be shed. Quiet requests are dropped
+ * silently, others get 'busy' error.
+ *
+ * \returns 0 to process the request, -1 if it's shed
+ */
+int
+memcached_overload_check(struct memcached_connection *con)
+{
+	struct memcached_service *p = con->cfg;
+	struct memcached_overload *o = &p->overload;
+	bool shed = (o->max_lag > 0 && o->lag > o->max_lag);
+	if (!shed && o->max_delay > 0)
+		shed = (fiber_clock() - con->read_time > o->max_delay);
+	if (!shed)
+		return 0;
+	if (con->noreply) {
+		p->stat.shed_dropped++;
+		return -1;
+	}
+	p->stat.shed_busy++;
+	memcached_error_BUSY();
+	return -1;
+}
@@ -0,0 +1,27 @@
+#ifndef   OVERLOAD_H_INCLUDED
+#define   OVERLOAD_H_INCLUDED
+
+#include <stdbool.h>
+
+struct memcached_connection;
+struct memcached_service;
+
+/* Thresholds of load shedding, 0 disables the check */
+struct memcached_overload {
+	double        max_lag;
+	double        max_delay;
+	/* lag of event loop, measured by the monitor fiber */
+	double        lag;
+	struct fiber *monitor;
+};
+
+int
+memcached_overload_start(struct memcached_service *p);
+
+void
+memcached_overload_stop(struct memcached_service *p);
+
+int
+memcached_overload_check(struct memcached_connection *con);
+
+#endif /* OVERLOAD_H_INCLUDED */
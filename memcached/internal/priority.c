@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <tarantool/module.h>
+
+#include "memcached.h"
+#include "constants.h"
+#include "mc_sasl.h"
+#include "priority.h"
+
+/**
+ * Priority classes: connections of an instance get the class of the
+ * instance, SASL users may be given their own class. Class sets the
+ * size of a batch, processed before the fiber yields, and connections
+ * below 'high' yield before every request, while a high priority
+ * connection has requests to process. Instances share the event loop,
+ * so high priority work is counted for all of them.
+ */
+
+/* Count of high priority connections with read, but unanswered requests */
+static int high_pending = 0;
+
+enum memcached_priority
+memcached_priority_parse(const char *name)
+{
+	if (strcmp(name, "low") == 0)
+		return MEMCACHED_PRIORITY_LOW;
+	else if (strcmp(name, "normal") == 0)
+		return MEMCACHED_PRIORITY_NORMAL;
+	else if (strcmp(name, "high") == 0)
+		return MEMCACHED_PRIORITY_HIGH;
+	return MEMCACHED_PRIORITY_MAX;
+}
+
+int
+memcached_set_user_priority(struct memcached_service *p, const char *name,
+			    const char *priority)
+{
+	enum memcached_priority prio = memcached_priority_parse(priority);
+	if (prio == MEMCACHED_PRIORITY_MAX)
+		return -1;
+	struct memcached_user_priority *user = p->user_priorities;
+	for (; user != NULL; user = user->next) {
+		if (strcmp(user->name, name) == 0) {
+			user->priority = prio;
+			return 0;
+		}
+	}
+	user = (struct memcached_user_priority *)
+		calloc(1, sizeof(struct memcached_user_priority));
+	if (user == NULL || (user->name = strdup(name)) == NULL) {
+		say_syserror("failed to allocate memory for user priority");
+		free(user);
+		return -1;
+	}
+	user->priority = prio;
+	user->next = p->user_priorities;
+	p->user_priorities = user;
+	return 0;
+}
+
+void
+memcached_clear_user_priorities(struct memcached_service *p)
+{
+	while (p->user_priorities != NULL) {
+		struct memcached_user_priority *user = p->user_priorities;
+		p->user_priorities = user->next;
+		free(user->name);
+		free(user);
+	}
+}
+
+/* Class of the connection, it's resolved on every read */
+static enum memcached_priority
+memcached_priority_of(struct memcached_connection *con)
+{
+	struct memcached_service *p = con->cfg;
+	if (p->user_priorities == NULL || p->sasl == false ||
+	    con->authentication_step != MEMCACHED_AUTH_OK)
+		return p->priority;
+	const char *name = memcached_sasl_username(con);
+	if (name == NULL)
+		return p->priority;
+	struct memcached_user_priority *user = p->user_priorities;
+	for (; user != NULL; user = user->next) {
+		if (strcmp(user->name, name) == 0)
+			return user->priority;
+	}
+	return p->priority;
+}
+
+/* Request is parsed, the connection has work to do */
+void
+memcached_priority_begin(struct memcached_connection *con)
+{
+	con->priority = memcached_priority_of(con);
+	if (con->priority == MEMCACHED_PRIORITY_HIGH && !con->prio_pending) {
+		con->prio_pending = true;
+		high_pending++;
+	}
+}
+
+/* Batch is answered, or the connection is closed */
+void
+memcached_priority_end(struct memcached_connection *con)
+{
+	if (con->prio_pending) {
+		con->prio_pending = false;
+		high_pending--;
+	}
+}
+
+/* Requests processed before the connection yields */
+int
+memcached_priority_batch(struct memcached_connection *con)
+{
+	int batch = con->cfg->batch_count;
+	switch (con->priority) {
+	case MEMCACHED_PRIORITY_LOW:
+		batch /= 4;
+		break;
+	case MEMCACHED_PRIORITY_HIGH:
+		batch *= 4;
+		break;
+	default:
+		break;
+	}
+	return batch;
+}
+
+/* Let high priority connections go first */
+void
+memcached_priority_yield(struct memcached_connection *con)
+{
+	if (con->priority == MEMCACHED_PRIORITY_HIGH || high_pending == 0)
+		return;
+	con->cfg->stat.priority_yields++;
+	fiber_reschedule();
+}
@@ -0,0 +1,45 @@
+#ifndef   PRIORITY_H_INCLUDED
+#define   PRIORITY_H_INCLUDED
+
+#include <stdbool.h>
+
+struct memcached_connection;
+struct memcached_service;
+
+enum memcached_priority {
+	MEMCACHED_PRIORITY_LOW    = 0x00,
+	MEMCACHED_PRIORITY_NORMAL = 0x01,
+	MEMCACHED_PRIORITY_HIGH   = 0x02,
+	MEMCACHED_PRIORITY_MAX
+};
+
+/* Priority class of a SASL user, overrides class of the instance */
+struct memcached_user_priority {
+	struct memcached_user_priority *next;
+	char                           *name;
+	enum memcached_priority         priority;
+};
+
+enum memcached_priority
+memcached_priority_parse(const char *name);
+
+int
+memcached_set_user_priority(struct memcached_service *p, const char *name,
+			    const char *priority);
+
+void
+memcached_clear_user_priorities(struct memcached_service *p);
+
+void
+memcached_priority_begin(struct memcached_connection *con);
+
+void
+memcached_priority_end(struct memcached_connection *con);
+
+int
+memcached_priority_batch(struct memcached_connection *con);
+
+void
+memcached_priority_yield(struct memcached_connection *con);
+
+#endif /* PRIORITY_H_INCLUDED */
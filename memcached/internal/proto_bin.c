@@ -8,12 +8,15 @@
 
 #include "memcached.h"
 #include "proto_bin.h"
+#include "proxy.h"
 
 #include "error.h"
 #include "utils.h"
 #include "constants.h"
 #include "memcached_layer.h"
 #include "mc_sasl.h"
+#include "dump.h"
+#include "vbucket.h"
 
 #include <small/ibuf.h>
 #include <small/obuf.h>
@@ -190,6 +193,34 @@ memcached_bin_process_set(struct memcached_connection *con)
 			  h->opaque, h->cas);
 	}
 
+	memcached_tuple_access(con, b->key, b->key_len);
+
+	/* Plain set of a small value and add probe the index once */
+	if ((cmd == MEMCACHED_SET_SET && memcached_tuple_blind(b->val_len)) ||
+	    cmd == MEMCACHED_SET_ADD) {
+		uint64_t new_cas = con->cfg->cas++;
+		int rc = 0;
+		if (cmd == MEMCACHED_SET_ADD)
+			rc = memcached_tuple_add(con, b->key, b->key_len,
+						 exptime, b->val, b->val_len,
+						 new_cas, ext->flags);
+		else
+			rc = memcached_tuple_set(con, b->key, b->key_len,
+						 exptime, b->val, b->val_len,
+						 new_cas, ext->flags);
+		if (rc == -1) {
+			box_txn_rollback();
+			return -1;
+		} else if (rc == 1) {
+			memcached_set_errcode(con, MEMCACHED_RES_KEY_EEXISTS);
+			return -1;
+		} else if (!con->noreply &&
+			   write_output_ok_cas(con, new_cas) == -1) {
+			return -1;
+		}
+		return 0;
+	}
+
 	box_tuple_t *tuple = NULL;
 	if (memcached_tuple_get(con, b->key, b->key_len, &tuple) == -1) {
 		box_txn_rollback();
@@ -204,12 +235,6 @@ memcached_bin_process_set(struct memcached_connection *con)
 	if (cmd == MEMCACHED_SET_REPLACE && (!tuple_exists || tuple_expired)) {
 		memcached_set_errcode(con, MEMCACHED_RES_KEY_ENOENT);
 		return -1;
-	} else if (cmd == MEMCACHED_SET_ADD && tuple_exists) {
-		if (!tuple_expired) {
-			memcached_set_errcode(con, MEMCACHED_RES_KEY_EEXISTS);
-			return -1;
-		}
-		con->cfg->stat.reclaimed++;
 	} else if (cmd == MEMCACHED_SET_CAS) {
 		if (!tuple_exists || tuple_expired) {
 			con->cfg->stat.cas_misses++;
@@ -228,8 +253,18 @@ memcached_bin_process_set(struct memcached_connection *con)
 	}
 
 	uint64_t new_cas = con->cfg->cas++;
-	if (memcached_tuple_set(con, b->key, b->key_len, exptime, b->val,
-				b->val_len, new_cas, ext->flags) == -1) {
+	int rc = 0;
+	if (tuple_exists && memcached_tuple_same_value(tuple, b->val,
+						       b->val_len)) {
+		con->cfg->stat.set_unchanged++;
+		rc = memcached_tuple_refresh(con, b->key, b->key_len, exptime,
+					     new_cas, ext->flags);
+	} else {
+		rc = memcached_tuple_set(con, b->key, b->key_len, exptime,
+					 b->val, b->val_len, new_cas,
+					 ext->flags);
+	}
+	if (rc == -1) {
 		box_txn_rollback();
 		return -1;
 	} else if (!con->noreply && write_output_ok_cas(con, new_cas) == -1) {
@@ -260,6 +295,7 @@ memcached_bin_process_get(struct memcached_connection *con)
 	    h->cmd == MEMCACHED_BIN_CMD_GETKQ)
 		con->noreply = true;
 
+	memcached_tuple_access(con, b->key, b->key_len);
 	box_tuple_t *tuple = NULL;
 	if (memcached_tuple_get(con, b->key, b->key_len, &tuple) == -1) {
 		box_txn_rollback();
@@ -272,6 +308,7 @@ memcached_bin_process_get(struct memcached_connection *con)
 
 	if (!tuple_exists || tuple_expired) {
 		con->cfg->stat.get_misses++;
+		con->part->get_misses++;
 		if (!con->noreply) {
 			memcached_set_errcode(con, MEMCACHED_RES_KEY_ENOENT);
 			return -1;
@@ -279,6 +316,8 @@ memcached_bin_process_get(struct memcached_connection *con)
 		return 0;
 	}
 	con->cfg->stat.get_hits++;
+	con->part->get_hits++;
+	memcached_tuple_touch(con->cfg, tuple);
 	struct memcached_get_ext ext;
 	uint32_t vlen = 0, klen = 0;
 	const char *pos  = box_tuple_field(tuple, 0);
@@ -320,18 +359,8 @@ memcached_bin_process_delete(struct memcached_connection *con)
 			  b->key, h->opaque);
 
 	con->cfg->stat.cmd_delete++;
-	uint32_t len = mp_sizeof_array(1) +
-		       mp_sizeof_str  (b->key_len);
-	char *begin = (char *)box_txn_alloc(len);
-	if (begin == NULL) {
-		memcached_error_ENOMEM(len, "key");
-		return -1;
-	}
-	char *end   = mp_encode_array(begin, 1);
-	      end   = mp_encode_str  (end, b->key, b->key_len);
-	assert(end <= begin + len);
 	box_tuple_t *tuple = NULL;
-	if (box_delete(con->cfg->space_id, 0, begin, end, &tuple) == -1) {
+	if (memcached_tuple_delete(con, b->key, b->key_len, &tuple) == -1) {
 		box_txn_rollback();
 		return -1;
 	}
@@ -486,6 +515,7 @@ memcached_bin_process_gat(struct memcached_connection *con)
 			  mp_bswap_u32(h->opaque), exptime);
 	}
 
+	memcached_tuple_access(con, b->key, b->key_len);
 	box_tuple_t *tuple = NULL;
 	if (memcached_tuple_get(con, b->key, b->key_len, &tuple) == -1) {
 		box_txn_rollback();
@@ -573,6 +603,7 @@ memcached_bin_process_delta(struct memcached_connection *con)
 				  (uint64_t )mp_bswap_u64(ext->initial));
 	}
 
+	memcached_tuple_access(con, b->key, b->key_len);
 	box_tuple_t *tuple = NULL;
 	if (memcached_tuple_get(con, b->key, b->key_len, &tuple) == -1) {
 		box_txn_rollback();
@@ -653,6 +684,7 @@ memcached_bin_process_pend(struct memcached_connection *con)
 
 	con->cfg->stat.cmd_set++;
 
+	memcached_tuple_access(con, b->key, b->key_len);
 	box_tuple_t *tuple = NULL;
 	if (memcached_tuple_get(con, b->key, b->key_len, &tuple) == -1) {
 		box_txn_rollback();
@@ -680,11 +712,10 @@ memcached_bin_process_pend(struct memcached_connection *con)
 	mp_next(&pos); /* skip cas */
 	flags            = mp_decode_uint(&pos);
 
-	char *begin = (char *)box_txn_alloc(b->val_len + vlen);
-	if (begin == NULL) {
-		memcached_error_ENOMEM(b->val_len + vlen, "value");
+	char *begin = (char *)memcached_scratch_alloc(con, b->val_len + vlen,
+						      "value");
+	if (begin == NULL)
 		return -1;
-	}
 
 	uint64_t new_cas = con->cfg->cas++;
 
@@ -786,6 +817,18 @@ memcached_bin_process_stat(struct memcached_connection *con) {
 		memcached_stat_all(con, append);
 	} else if (b->key_len == 5  && !strncmp(b->key, "reset", 5)) {
 		memcached_stat_reset(con, append);
+	} else if (b->key_len == 4  && !strncmp(b->key, "dump", 4)) {
+		if (memcached_dump_stat(con, append) == -1)
+			return -1;
+	} else if (b->key_len == 10 && !strncmp(b->key, "partitions", 10)) {
+		if (memcached_stat_partitions(con, append) == -1)
+			return -1;
+	} else if (b->key_len == 7  && !strncmp(b->key, "tenants", 7)) {
+		if (memcached_stat_tenants(con, append) == -1)
+			return -1;
+	} else if (b->key_len == 7  && !strncmp(b->key, "vbucket", 7)) {
+		if (memcached_vbucket_stat(con, append) == -1)
+			return -1;
 /*
 	} else if (b->key_len == 6  && !strncmp(b->key, "detail", 6)) {
 		memcached_error_NOT_SUPPORTED("stat detail");
@@ -986,6 +1029,16 @@ memcached_bin_ntxn(struct memcached_connection *con)
 	return 0;
 };
 
+/* Commands, that can't be served by read only replica */
+static inline int
+memcached_bin_is_write(struct memcached_connection *con)
+{
+	uint8_t cmd = con->hdr->cmd;
+	return (memcached_bin_ntxn(con) ||
+		cmd == MEMCACHED_BIN_CMD_FLUSH ||
+		cmd == MEMCACHED_BIN_CMD_FLUSHQ);
+}
+
 int
 memcached_bin_process(struct memcached_connection *con)
 {
@@ -998,6 +1051,13 @@ memcached_bin_process(struct memcached_connection *con)
 		/* con->close_connection = true; */
 		return -1;
 	}
+	if (memcached_vbucket_check(con) == -1)
+		return -1;
+	if (con->cfg->read_only && memcached_bin_is_write(con)) {
+		con->cfg->stat.read_only_rejects++;
+		memcached_error_READ_ONLY(con->cfg->master);
+		return -1;
+	}
 	if (memcached_bin_ntxn(con)) {
 		box_txn_begin();
 	}
@@ -1136,5 +1196,7 @@ memcached_set_bin(struct memcached_connection *con)
 {
 	con->cb.parse_request   = memcached_bin_parse;
 	con->cb.process_request = memcached_bin_process;
+	if (con->cfg->proxy != NULL)
+		con->cb.process_request = memcached_proxy_process;
 	con->cb.process_error   = memcached_bin_error;
 }
@@ -4,4 +4,7 @@
 void
 memcached_set_bin(struct memcached_connection *con);
 
+int
+memcached_bin_process(struct memcached_connection *con);
+
 #endif /* PROTO_BINARY_H_INCLUDED */
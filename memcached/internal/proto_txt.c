@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <strings.h>
 #include <inttypes.h>
 
 #include <tarantool/module.h>
@@ -14,6 +16,7 @@
 #include "utils.h"
 #include "proto_txt.h"
 #include "proto_txt_parser.h"
+#include "dump.h"
 
 #define memcached_txt_DUP(_con, _msg, _len) do {				  \
 	if (!(_con)->noreply && obuf_dup((_con)->out, (_msg), (_len)) != (_len)) {\
@@ -27,6 +30,7 @@ static inline int
 txt_get_single(struct memcached_connection *con, const char *key,
 	       size_t key_len, bool get_cas)
 {
+	memcached_tuple_access(con, key, key_len);
 	box_tuple_t *tuple = NULL;
 	if (memcached_tuple_get(con, key, key_len, &tuple) == -1) {
 		box_txn_rollback();
@@ -39,6 +43,7 @@ txt_get_single(struct memcached_connection *con, const char *key,
 
 	if (!tuple_exists || tuple_expired) {
 		con->cfg->stat.get_misses++;
+		con->part->get_misses++;
 		return 1;
 	}
 	uint32_t vlen = 0, klen = 0;
@@ -81,6 +86,8 @@ txt_get_single(struct memcached_connection *con, const char *key,
 	}
 
 	con->cfg->stat.get_hits++;
+	con->part->get_hits++;
+	memcached_tuple_touch(con->cfg, tuple);
 	return 0;
 }
 
@@ -127,6 +134,36 @@ memcached_txt_process_set(struct memcached_connection *con)
 	size_t        key_len = con->request.key_len;
 	if (cmd == MEMCACHED_TXT_CMD_CAS)
 		cas_expected = con->request.cas;
+	memcached_tuple_access(con, key, key_len);
+
+	/* Plain set of a small value and add probe the index once */
+	if ((cmd == MEMCACHED_TXT_CMD_SET &&
+	     memcached_tuple_blind(con->request.data_len)) ||
+	    cmd == MEMCACHED_TXT_CMD_ADD) {
+		con->cfg->stat.cmd_set++;
+		uint64_t exptime = convert_exptime(con->request.exptime);
+		uint64_t new_cas = con->cfg->cas++;
+		int rc = 0;
+		if (cmd == MEMCACHED_TXT_CMD_ADD)
+			rc = memcached_tuple_add(con, key, key_len, exptime,
+						 con->request.data,
+						 con->request.data_len,
+						 new_cas, con->request.flags);
+		else
+			rc = memcached_tuple_set(con, key, key_len, exptime,
+						 con->request.data,
+						 con->request.data_len,
+						 new_cas, con->request.flags);
+		if (rc == -1) {
+			box_txn_rollback();
+			return -1;
+		} else if (rc == 1) {
+			memcached_txt_DUP(con, "NOT_STORED\r\n", 12);
+		} else {
+			memcached_txt_DUP(con, "STORED\r\n", 8);
+		}
+		return 0;
+	}
 	
 	box_tuple_t *tuple = NULL;
 	if (memcached_tuple_get(con, key, key_len, &tuple) == -1) {
@@ -144,12 +181,6 @@ memcached_txt_process_set(struct memcached_connection *con)
 	if (cmd == MEMCACHED_TXT_CMD_REPLACE && (!tuple_exists || tuple_expired)) {
 		memcached_txt_DUP(con, "NOT_STORED\r\n", 12);
 		return 0;
-	} else if (cmd == MEMCACHED_TXT_CMD_ADD && tuple_exists) {
-		if (!tuple_expired) {
-			memcached_txt_DUP(con, "NOT_STORED\r\n", 12);
-			return 0;
-		}
-		con->cfg->stat.reclaimed++;
 	} else if (cmd == MEMCACHED_TXT_CMD_CAS) {
 		if (!tuple_exists || tuple_expired) {
 			con->cfg->stat.cas_misses++;
@@ -172,8 +203,17 @@ memcached_txt_process_set(struct memcached_connection *con)
 	size_t    value_len = con->request.data_len;
 	uint64_t new_cas = con->cfg->cas++;
 
-	if (memcached_tuple_set(con, key, key_len, exptime, value,
-				value_len, new_cas, flags) == -1) {
+	int rc = 0;
+	if (tuple_exists && memcached_tuple_same_value(tuple, value,
+						       value_len)) {
+		con->cfg->stat.set_unchanged++;
+		rc = memcached_tuple_refresh(con, key, key_len, exptime,
+					     new_cas, flags);
+	} else {
+		rc = memcached_tuple_set(con, key, key_len, exptime, value,
+					 value_len, new_cas, flags);
+	}
+	if (rc == -1) {
 		box_txn_rollback();
 		return -1;
 	}
@@ -187,6 +227,7 @@ memcached_txt_process_delta(struct memcached_connection *con)
 	const char    *key = con->request.key;
 	size_t     key_len = con->request.key_len;
 
+	memcached_tuple_access(con, key, key_len);
 	box_tuple_t *tuple = NULL;
 	if (memcached_tuple_get(con, key, key_len, &tuple) == -1) {
 		box_txn_rollback();
@@ -258,6 +299,7 @@ memcached_txt_process_pend(struct memcached_connection *con)
 	con->cfg->stat.cmd_set++;
 	uint64_t new_cas = con->cfg->cas++;
 
+	memcached_tuple_access(con, key, key_len);
 	box_tuple_t *tuple = NULL;
 	if (memcached_tuple_get(con, key, key_len, &tuple) == -1) {
 		box_txn_rollback();
@@ -284,11 +326,10 @@ memcached_txt_process_pend(struct memcached_connection *con)
 	mp_next(&pos); /* skip cas */
 	flags            = mp_decode_uint(&pos);
 
-	char *begin = (char *)box_txn_alloc(data_len + vlen);
-	if (begin == NULL) {
-		memcached_error_ENOMEM(data_len + vlen, "value");
+	char *begin = (char *)memcached_scratch_alloc(con, data_len + vlen,
+						      "value");
+	if (begin == NULL)
 		return -1;
-	}
 	if (con->request.op == MEMCACHED_TXT_CMD_PREPEND) {
 		memcpy(begin, data, data_len);
 		memcpy(begin + data_len, vpos, vlen);
@@ -316,18 +357,8 @@ memcached_txt_process_delete(struct memcached_connection *con)
 	size_t key_len = con->request.key_len;
 
 	con->cfg->stat.cmd_delete++;
-	uint32_t len = mp_sizeof_array(1) +
-		       mp_sizeof_str  (key_len);
-	char *begin = (char *)box_txn_alloc(len);
-	if (begin == NULL) {
-		memcached_error_ENOMEM(len, "key");
-		return -1;
-	}
-	char *end   = mp_encode_array(begin, 1);
-	      end   = mp_encode_str  (end, key, key_len);
-	assert(end <= begin + len);
 	box_tuple_t *tuple = NULL;
-	if (box_delete(con->cfg->space_id, 0, begin, end, &tuple) == -1) {
+	if (memcached_tuple_delete(con, key, key_len, &tuple) == -1) {
 		box_txn_rollback();
 		return -1;
 	}
@@ -447,6 +478,19 @@ memcached_txt_process_stat(struct memcached_connection *con) {
 	} else if (req->key_len == 5  && !strncmp(req->key, "reset", 5)) {
 		if (memcached_stat_reset(con, append) == -1)
 			goto error;
+	} else if (req->key_len == 10 && !strncmp(req->key, "partitions", 10)) {
+		if (memcached_stat_partitions(con, append) == -1)
+			goto error;
+	} else if (req->key_len == 7  && !strncmp(req->key, "tenants", 7)) {
+		if (memcached_stat_tenants(con, append) == -1)
+			goto error;
+	} else if (req->key_len == 4  && !strncmp(req->key, "dump", 4)) {
+		if (memcached_dump_stat(con, append) == -1) {
+			/* output is already (partially) written */
+			if (con->close_connection)
+				return -1;
+			goto error;
+		}
 /*	} else if (req->key_len == 6  && !strncmp(req->key, "detail", 6)) {
 		memcached_error_NOT_SUPPORTED("stat detail");
 		return -1;
@@ -520,11 +564,24 @@ memcached_txt_ntxn(struct memcached_connection *con)
 	return 0;
 };
 
+/* Commands, that can't be served by read only replica */
+static inline int
+memcached_txt_is_write(struct memcached_connection *con)
+{
+	return (memcached_txt_ntxn(con) ||
+		con->request.op == MEMCACHED_TXT_CMD_FLUSH);
+}
+
 int
 memcached_txt_process(struct memcached_connection *con)
 {
 	int rv = 0;
 	/* Process message */
+	if (con->cfg->read_only && memcached_txt_is_write(con)) {
+		con->cfg->stat.read_only_rejects++;
+		memcached_error_READ_ONLY(con->cfg->master);
+		return -1;
+	}
 	if (memcached_txt_ntxn(con))
 		box_txn_begin();
 	if (con->request.op < memcached_txt_cmd_MAX) {
@@ -536,12 +593,51 @@ memcached_txt_process(struct memcached_connection *con)
 	return rv;
 }
 
+/**
+ * 'stats' with arguments. Generated parser takes only bare 'stats', so
+ * its arguments are parsed here, like keys of 'get': 'key' points to the
+ * first one and 'key_len' spans all of them.
+ *
+ * \returns 0 on success, 1 if the line isn't read yet, -1 if it's not
+ *          'stats' with arguments
+ */
+static int
+memcached_txt_parse_stats(struct memcached_connection *con,
+			  const char **p_ptr, const char *pe)
+{
+	const char *p = *p_ptr;
+	if (pe - p < 6 || strncasecmp(p, "stats ", 6) != 0)
+		return -1;
+	const char *eol = (const char *)memchr(p, '\n', pe - p);
+	if (eol == NULL)
+		return 1;
+	const char *end = (eol[-1] == '\r' ? eol - 1 : eol);
+	struct memcached_txt_request *req = &con->request;
+	memset(req, 0, sizeof(struct memcached_txt_request));
+	req->op = MEMCACHED_TXT_CMD_STATS;
+	for (p += 5; p < end; ) {
+		for (; p < end && *p == ' '; ++p);
+		const char *s = p;
+		for (; p < end && *p != ' '; ++p);
+		if (p == s)
+			break;
+		if (req->key == NULL)
+			req->key = s;
+		req->key_len = p - req->key;
+		req->key_count += 1;
+	}
+	*p_ptr = eol + 1;
+	return 0;
+}
+
 int
 memcached_txt_parse(struct memcached_connection *con)
 {
 	struct ibuf      *in = con->in;
 	const char *reqstart = in->rpos, *end = in->wpos;
-	int rv = memcached_txt_parser(con, &reqstart, end);
+	int rv = memcached_txt_parse_stats(con, &reqstart, end);
+	if (rv == -1)
+		rv = memcached_txt_parser(con, &reqstart, end);
 	if (reqstart > in->rpos)
 		con->len = reqstart - in->rpos;
 	if (rv == 0)
@@ -591,6 +687,8 @@ memcached_txt_error(struct memcached_connection *con,
 	if (err == MEMCACHED_RES_NOT_SUPPORTED ||
 	    err == MEMCACHED_RES_UNKNOWN_COMMAND) {
 		obuf_dup(out, "ERROR", 5);
+	} else if (err == MEMCACHED_RES_NOT_STORED) {
+		obuf_dup(out, "NOT_STORED", 10);
 	} else if (err == MEMCACHED_RES_EINVAL       ||
 		   err == MEMCACHED_RES_DELTA_BADVAL) {
 		/* TODO: add error type support */
@@ -0,0 +1,1108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+
+#include <tarantool/module.h>
+#include <msgpuck.h>
+#include <small/ibuf.h>
+#include <small/obuf.h>
+#include <small/mempool.h>
+
+#include "memcached.h"
+#include "constants.h"
+#include "error.h"
+#include "network.h"
+#include "proto_bin.h"
+#include "proxy.h"
+
+#define PROXY_READAHEAD       16384
+#define PROXY_CONNECT_TIMEOUT 1.0
+#define PROXY_RECONNECT_DELAY 0.5
+#define PROXY_HOT_KEYS        64
+#define PROXY_SKETCH_ROWS     4
+#define PROXY_SKETCH_SIZE     1024
+
+struct proxy_backend;
+struct proxy_client;
+struct proxy_hot_key;
+
+/**
+ * Request, forwarded to backend. It's linked into queue of backend
+ * connection (responses come in the same order) and into pending list
+ * of client connection (responses are written back in the same order).
+ */
+struct proxy_request {
+	struct proxy_request *next_in_conn;
+	struct proxy_request *next_in_client;
+	/* NULL, if client doesn't wait for it anymore */
+	struct proxy_client  *client;
+	/* command and opaque, sent by client */
+	uint8_t               cmd;
+	uint32_t              opaque;
+	bool                  quiet;
+	/* response isn't written back (all, but one, broadcast replies) */
+	bool                  silent;
+	bool                  done;
+	char                 *resp;
+	size_t                resp_len;
+	/* value of hot key is copied to replicas from the response */
+	struct proxy_hot_key *hot;
+	uint32_t              hot_gen;
+	/* CAS of the owner's value, if response comes from a copy
+	 * (network byte order) */
+	uint64_t              copy_cas;
+};
+
+struct proxy_queue {
+	struct proxy_request *first;
+	struct proxy_request *last;
+};
+
+#define proxy_queue_push(_q, _req, _link) do {				\
+		(_req)->_link = NULL;					\
+		if ((_q)->last != NULL)					\
+			(_q)->last->_link = (_req);			\
+		else							\
+			(_q)->first = (_req);				\
+		(_q)->last = (_req);					\
+	} while (0)
+
+#define proxy_queue_shift(_q, _link) do {				\
+		(_q)->first = (_q)->first->_link;			\
+		if ((_q)->first == NULL)				\
+			(_q)->last = NULL;				\
+	} while (0)
+
+/* Pipelined connection to backend, shared by all clients */
+struct proxy_conn {
+	struct proxy_backend *backend;
+	int                   fd;
+	/* requests, waiting for response */
+	struct proxy_queue    queue;
+	/* serializes writes of requests */
+	box_latch_t          *latch;
+	struct fiber         *reader;
+	struct ibuf           in;
+};
+
+struct proxy_backend {
+	struct memcached_proxy *proxy;
+	char                   *host;
+	char                   *port;
+	struct proxy_conn      *conns;
+	uint32_t                next;
+};
+
+struct proxy_client {
+	struct proxy_queue  pending;
+	struct fiber_cond  *cond;
+};
+
+/**
+ * Key, read often enough to melt its backend. Its value is copied to
+ * 'hot_replicas' next backends with short TTL and reads are spread
+ * among them, while copies are alive. Write of the key deletes copies.
+ */
+struct proxy_hot_key {
+	uint64_t  hash;
+	char     *key;
+	uint16_t  key_len;
+	/* changed on every write, copy of older value isn't made */
+	uint32_t  gen;
+	/* CAS of the copied value on the owner (network byte order) */
+	uint64_t  cas;
+	double    copies_until;
+	/* read, that will make copies, is in flight */
+	double    pending_until;
+	uint32_t  next;
+};
+
+struct memcached_proxy {
+	struct proxy_backend *backends;
+	int                   backend_count;
+	int                   conn_count;
+	double                timeout;
+	bool                  running;
+	struct mempool        req_pool;
+	struct memcached_stat *stat;
+	/* hot keys detection and replication */
+	int                   hot_replicas;
+	uint32_t              hot_threshold;
+	uint32_t              hot_ttl;
+	uint32_t              hot_gen;
+	double                sketch_decay;
+	uint32_t              sketch[PROXY_SKETCH_ROWS][PROXY_SKETCH_SIZE];
+	struct proxy_hot_key  hot[PROXY_HOT_KEYS];
+};
+
+/**
+ * Jump consistent hash (Lamping, Veach). Moves only 1/n of keys when
+ * n-th bucket is added.
+ */
+int32_t
+memcached_jump_hash(uint64_t key, int32_t buckets)
+{
+	int64_t b = -1, j = 0;
+	while (j < buckets) {
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (b + 1) * ((double )(1LL << 31) / (double )((key >> 33) + 1));
+	}
+	return b;
+}
+
+/* FNV-1a */
+static inline uint64_t
+proxy_key_hash(const char *key, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; ++i) {
+		h ^= (uint8_t )key[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/**
+ * Quiet commands are forwarded as non-quiet ones, so every request
+ * gets exactly one response, and responses are matched by order.
+ *
+ * \returns command to forward or -1, if command isn't routed by key
+ */
+static inline int
+proxy_forward_cmd(uint8_t cmd)
+{
+	switch (cmd) {
+	case MEMCACHED_BIN_CMD_GETQ:     return MEMCACHED_BIN_CMD_GET;
+	case MEMCACHED_BIN_CMD_GETKQ:    return MEMCACHED_BIN_CMD_GETK;
+	case MEMCACHED_BIN_CMD_SETQ:     return MEMCACHED_BIN_CMD_SET;
+	case MEMCACHED_BIN_CMD_ADDQ:     return MEMCACHED_BIN_CMD_ADD;
+	case MEMCACHED_BIN_CMD_REPLACEQ: return MEMCACHED_BIN_CMD_REPLACE;
+	case MEMCACHED_BIN_CMD_DELETEQ:  return MEMCACHED_BIN_CMD_DELETE;
+	case MEMCACHED_BIN_CMD_INCRQ:    return MEMCACHED_BIN_CMD_INCR;
+	case MEMCACHED_BIN_CMD_DECRQ:    return MEMCACHED_BIN_CMD_DECR;
+	case MEMCACHED_BIN_CMD_APPENDQ:  return MEMCACHED_BIN_CMD_APPEND;
+	case MEMCACHED_BIN_CMD_PREPENDQ: return MEMCACHED_BIN_CMD_PREPEND;
+	case MEMCACHED_BIN_CMD_GATQ:     return MEMCACHED_BIN_CMD_GAT;
+	case MEMCACHED_BIN_CMD_GATKQ:    return MEMCACHED_BIN_CMD_GATK;
+	case MEMCACHED_BIN_CMD_GET:
+	case MEMCACHED_BIN_CMD_GETK:
+	case MEMCACHED_BIN_CMD_SET:
+	case MEMCACHED_BIN_CMD_ADD:
+	case MEMCACHED_BIN_CMD_REPLACE:
+	case MEMCACHED_BIN_CMD_DELETE:
+	case MEMCACHED_BIN_CMD_INCR:
+	case MEMCACHED_BIN_CMD_DECR:
+	case MEMCACHED_BIN_CMD_APPEND:
+	case MEMCACHED_BIN_CMD_PREPEND:
+	case MEMCACHED_BIN_CMD_TOUCH:
+	case MEMCACHED_BIN_CMD_GAT:
+	case MEMCACHED_BIN_CMD_GATK:
+		return cmd;
+	default:
+		return -1;
+	}
+}
+
+static inline bool
+proxy_is_read(uint8_t cmd)
+{
+	return cmd == MEMCACHED_BIN_CMD_GET  || cmd == MEMCACHED_BIN_CMD_GETQ ||
+	       cmd == MEMCACHED_BIN_CMD_GETK || cmd == MEMCACHED_BIN_CMD_GETKQ;
+}
+
+/* Quiet get doesn't reply on miss, other quiet commands on success */
+static inline bool
+proxy_response_dropped(struct proxy_request *req, uint16_t status)
+{
+	if (req->silent)
+		return true;
+	if (!req->quiet)
+		return false;
+	switch (req->cmd) {
+	case MEMCACHED_BIN_CMD_GETQ:
+	case MEMCACHED_BIN_CMD_GETKQ:
+	case MEMCACHED_BIN_CMD_GATQ:
+	case MEMCACHED_BIN_CMD_GATKQ:
+		return status != MEMCACHED_RES_OK;
+	default:
+		return status == MEMCACHED_RES_OK;
+	}
+}
+
+static inline void
+proxy_request_delete(struct memcached_proxy *proxy, struct proxy_request *req)
+{
+	free(req->resp);
+	mempool_free(&proxy->req_pool, req);
+}
+
+static void
+proxy_request_complete(struct memcached_proxy *proxy,
+		       struct proxy_request *req, const char *resp,
+		       size_t len)
+{
+	if (req->client == NULL) {
+		proxy_request_delete(proxy, req);
+		return;
+	}
+	const struct memcached_hdr *hdr = (const struct memcached_hdr *)resp;
+	if (!proxy_response_dropped(req, mp_bswap_u16(hdr->status))) {
+		req->resp = (char *)malloc(len);
+		if (req->resp == NULL) {
+			say_error("Failed to allocate %zu bytes for proxy "
+				  "response", len);
+		} else {
+			memcpy(req->resp, resp, len);
+			req->resp_len = len;
+			/* client sees the command it sent */
+			((struct memcached_hdr *)req->resp)->cmd = req->cmd;
+			/* and CAS of the owner, that a later cas is
+			 * compared with */
+			if (req->copy_cas != 0 && hdr->status == 0)
+				((struct memcached_hdr *)req->resp)->cas =
+					req->copy_cas;
+		}
+	}
+	req->done = true;
+	fiber_cond_broadcast(req->client->cond);
+}
+
+/* Encode SERVER_ERROR response, buf must fit header and 256 bytes */
+static size_t
+proxy_error_encode(char *buf, uint8_t cmd, uint32_t opaque,
+		   const char *errstr)
+{
+	size_t err_len = strlen(errstr);
+	if (err_len > 256)
+		err_len = 256;
+	struct memcached_hdr hdr;
+	memset(&hdr, 0, sizeof(struct memcached_hdr));
+	hdr.magic   = MEMCACHED_BIN_RESPONSE;
+	hdr.cmd     = cmd;
+	hdr.status  = mp_bswap_u16(MEMCACHED_RES_SERVER_ERROR);
+	hdr.tot_len = mp_bswap_u32(err_len);
+	hdr.opaque  = mp_bswap_u32(opaque);
+	memcpy(buf, &hdr, sizeof(struct memcached_hdr));
+	memcpy(buf + sizeof(struct memcached_hdr), errstr, err_len);
+	return sizeof(struct memcached_hdr) + err_len;
+}
+
+static void
+proxy_request_fail(struct memcached_proxy *proxy, struct proxy_request *req,
+		   const char *errstr)
+{
+	proxy->stat->proxy_errors++;
+	char resp[sizeof(struct memcached_hdr) + 256];
+	size_t len = proxy_error_encode(resp, req->cmd, req->opaque, errstr);
+	proxy_request_complete(proxy, req, resp, len);
+}
+
+static inline struct proxy_request *
+proxy_request_new(struct memcached_connection *con)
+{
+	struct memcached_proxy *proxy = con->cfg->proxy;
+	struct proxy_request *req = (struct proxy_request *)
+		mempool_alloc(&proxy->req_pool);
+	if (req == NULL) {
+		memcached_error_ENOMEM(sizeof(struct proxy_request),
+				       "proxy request");
+		return NULL;
+	}
+	memset(req, 0, sizeof(struct proxy_request));
+	req->client = con->proxy;
+	req->cmd    = con->hdr->cmd;
+	req->opaque = con->hdr->opaque;
+	proxy_queue_push(&con->proxy->pending, req, next_in_client);
+	return req;
+}
+
+static int
+proxy_conn_connect(struct proxy_conn *c)
+{
+	struct proxy_backend *b = c->backend;
+	struct addrinfo hints, *res = NULL;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (coio_getaddrinfo(b->host, b->port, &hints, &res,
+			     PROXY_CONNECT_TIMEOUT) != 0)
+		return -1;
+	int fd = -1;
+	for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd == -1)
+			continue;
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		if (errno == EINPROGRESS &&
+		    coio_wait(fd, COIO_WRITE, PROXY_CONNECT_TIMEOUT) &
+		    COIO_WRITE) {
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if (getsockopt(fd, SOL_SOCKET, SO_ERROR,
+				       &err, &len) == 0 && err == 0)
+				break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd == -1)
+		return -1;
+	c->fd = fd;
+	say_info("Connected to memcached backend %s:%s", b->host, b->port);
+	return 0;
+}
+
+/* Close connection and fail every request, that waits for response */
+static void
+proxy_conn_reset(struct proxy_conn *c, const char *reason)
+{
+	struct proxy_backend *b = c->backend;
+	box_latch_lock(c->latch);
+	if (c->fd != -1) {
+		say_warn("Connection to memcached backend %s:%s is closed: %s",
+			 b->host, b->port, reason);
+		close(c->fd);
+		c->fd = -1;
+	}
+	char errstr[256];
+	snprintf(errstr, 256, "Backend %s:%s is unavailable", b->host,
+		 b->port);
+	struct proxy_request *req = NULL;
+	while ((req = c->queue.first) != NULL) {
+		proxy_queue_shift(&c->queue, next_in_conn);
+		proxy_request_fail(b->proxy, req, errstr);
+	}
+	ibuf_reset(&c->in);
+	box_latch_unlock(c->latch);
+}
+
+/* Match every complete response with the oldest request */
+static int
+proxy_conn_parse(struct proxy_conn *c)
+{
+	const size_t hlen = sizeof(struct memcached_hdr);
+	while (ibuf_used(&c->in) >= hlen) {
+		const struct memcached_hdr *hdr =
+			(const struct memcached_hdr *)c->in.rpos;
+		if (hdr->magic != MEMCACHED_BIN_RESPONSE)
+			return -1;
+		size_t len = hlen + mp_bswap_u32(hdr->tot_len);
+		if (ibuf_used(&c->in) < len)
+			break;
+		struct proxy_request *req = c->queue.first;
+		if (req == NULL)
+			return -1;
+		proxy_queue_shift(&c->queue, next_in_conn);
+		proxy_request_complete(c->backend->proxy, req, c->in.rpos, len);
+		c->in.rpos += len;
+	}
+	return 0;
+}
+
+static int
+proxy_conn_loop(va_list ap)
+{
+	struct proxy_conn *c = va_arg(ap, struct proxy_conn *);
+	fiber_set_cancellable(true);
+	while (!fiber_is_cancelled()) {
+		if (c->fd == -1 && proxy_conn_connect(c) == -1) {
+			fiber_sleep(PROXY_RECONNECT_DELAY);
+			continue;
+		}
+		if (ibuf_used(&c->in) == 0)
+			ibuf_reset(&c->in);
+		if (ibuf_reserve(&c->in, PROXY_READAHEAD) == NULL) {
+			proxy_conn_reset(c, "out of memory");
+			continue;
+		}
+		ssize_t n = read(c->fd, c->in.wpos, ibuf_unused(&c->in));
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR)) {
+			coio_wait(c->fd, COIO_READ, TIMEOUT_INFINITY);
+			continue;
+		} else if (n <= 0) {
+			proxy_conn_reset(c, n == 0 ? "EOF" : strerror(errno));
+			continue;
+		}
+		c->in.wpos += n;
+		if (proxy_conn_parse(c) == -1)
+			proxy_conn_reset(c, "unexpected response");
+	}
+	proxy_conn_reset(c, "proxy is stopped");
+	return 0;
+}
+
+/**
+ * Requests for a key go over the same connection to backend (while it's
+ * alive), so backend processes them in the order they're sent: a copy
+ * of hot key isn't written before its invalidation, and it isn't read
+ * before it's written.
+ */
+static struct proxy_conn *
+proxy_backend_conn(struct proxy_backend *b, uint64_t hash)
+{
+	int count = b->proxy->conn_count;
+	for (int i = 0; i < count; ++i) {
+		struct proxy_conn *c = &b->conns[(hash + i) % count];
+		if (c->fd != -1)
+			return c;
+	}
+	return NULL;
+}
+
+/* Queue request and write it to backend connection */
+static int
+proxy_conn_write(struct proxy_conn *c, struct proxy_request *req,
+		 struct iovec *iov, int iovcnt, size_t len)
+{
+	box_latch_lock(c->latch);
+	if (c->fd == -1) {
+		box_latch_unlock(c->latch);
+		return -1;
+	}
+	proxy_queue_push(&c->queue, req, next_in_conn);
+	if (mnet_writev(c->fd, iov, iovcnt, len) < len) {
+		/* reader will fail every queued request */
+		shutdown(c->fd, SHUT_RDWR);
+	}
+	box_latch_unlock(c->latch);
+	return 0;
+}
+
+/* Write the request, being processed, to backend connection */
+static int
+proxy_send(struct memcached_connection *con, struct proxy_conn *c,
+	   struct proxy_request *req, uint8_t cmd)
+{
+	const struct memcached_hdr *h = con->hdr;
+	/* header is converted to host byte order by parser */
+	struct memcached_hdr hdr;
+	memcpy(&hdr, h, sizeof(struct memcached_hdr));
+	hdr.cmd     = cmd;
+	hdr.key_len = mp_bswap_u16(h->key_len);
+	hdr.tot_len = mp_bswap_u32(h->tot_len);
+	hdr.opaque  = mp_bswap_u32(h->opaque);
+	hdr.cas     = mp_bswap_u64(h->cas);
+	struct iovec iov[2];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len  = sizeof(struct memcached_hdr);
+	iov[1].iov_base = (char *)h + sizeof(struct memcached_hdr);
+	iov[1].iov_len  = h->tot_len;
+	size_t len = sizeof(struct memcached_hdr) + h->tot_len;
+	return proxy_conn_write(c, req, iov, h->tot_len > 0 ? 2 : 1, len);
+}
+
+/**
+ * Send request, nobody waits a response for (copies of hot keys and
+ * their invalidation). Failures are ignored, since copies have TTL.
+ */
+static void
+proxy_send_orphan(struct memcached_proxy *proxy, struct proxy_backend *b,
+		  uint64_t hash, uint8_t cmd, struct iovec *iov, int iovcnt,
+		  size_t len)
+{
+	struct proxy_request *req = (struct proxy_request *)
+		mempool_alloc(&proxy->req_pool);
+	if (req == NULL)
+		return;
+	memset(req, 0, sizeof(struct proxy_request));
+	req->cmd = cmd;
+	struct proxy_conn *c = proxy_backend_conn(b, hash);
+	if (c == NULL || proxy_conn_write(c, req, iov, iovcnt, len) == -1)
+		proxy_request_delete(proxy, req);
+}
+
+static struct proxy_request *
+proxy_forward(struct memcached_connection *con, struct proxy_backend *b,
+	      uint64_t hash, uint8_t cmd, bool silent, uint64_t copy_cas)
+{
+	struct memcached_proxy *proxy = con->cfg->proxy;
+	struct proxy_request *req = proxy_request_new(con);
+	if (req == NULL)
+		return NULL;
+	req->quiet  = (cmd != con->hdr->cmd);
+	req->silent = silent;
+	/* response may be read, while request is written */
+	req->copy_cas = copy_cas;
+	proxy->stat->proxy_forwarded++;
+	struct proxy_conn *c = proxy_backend_conn(b, hash);
+	if (c == NULL || proxy_send(con, c, req, cmd) == -1) {
+		char errstr[256];
+		snprintf(errstr, 256, "Backend %s:%s is unavailable", b->host,
+			 b->port);
+		proxy_request_fail(proxy, req, errstr);
+	}
+	return req;
+}
+
+/**
+ * Count-min sketch of reads per key. Counters are halved every second,
+ * so estimation is about twice the count of reads per second.
+ */
+static uint32_t
+proxy_sketch_get(struct memcached_proxy *proxy, uint64_t hash, bool add)
+{
+	uint32_t est = UINT32_MAX;
+	for (int r = 0; r < PROXY_SKETCH_ROWS; ++r) {
+		uint32_t *cnt = &proxy->sketch[r][(hash >> (16 * r)) %
+						  PROXY_SKETCH_SIZE];
+		if (add && *cnt < UINT32_MAX)
+			(*cnt)++;
+		if (*cnt < est)
+			est = *cnt;
+	}
+	return est;
+}
+
+static void
+proxy_sketch_decay(struct memcached_proxy *proxy)
+{
+	double now = fiber_time();
+	if (now < proxy->sketch_decay)
+		return;
+	proxy->sketch_decay = now + 1.0;
+	for (int r = 0; r < PROXY_SKETCH_ROWS; ++r) {
+		for (int i = 0; i < PROXY_SKETCH_SIZE; ++i)
+			proxy->sketch[r][i] >>= 1;
+	}
+	/* forget keys, that aren't hot anymore */
+	for (int i = 0; i < PROXY_HOT_KEYS; ++i) {
+		struct proxy_hot_key *hot = &proxy->hot[i];
+		if (hot->key == NULL ||
+		    proxy_sketch_get(proxy, hot->hash, false) >=
+		    proxy->hot_threshold / 2)
+			continue;
+		free(hot->key);
+		memset(hot, 0, sizeof(struct proxy_hot_key));
+	}
+}
+
+static struct proxy_hot_key *
+proxy_hot_find(struct memcached_proxy *proxy, uint64_t hash,
+	       const char *key, uint16_t key_len)
+{
+	for (int i = 0; i < PROXY_HOT_KEYS; ++i) {
+		struct proxy_hot_key *hot = &proxy->hot[i];
+		if (hot->key != NULL && hot->hash == hash &&
+		    hot->key_len == key_len &&
+		    memcmp(hot->key, key, key_len) == 0)
+			return hot;
+	}
+	return NULL;
+}
+
+/* Take free slot or replace the coldest key, if it's colder */
+static struct proxy_hot_key *
+proxy_hot_insert(struct memcached_proxy *proxy, uint64_t hash,
+		 const char *key, uint16_t key_len, uint32_t est)
+{
+	struct proxy_hot_key *victim = NULL;
+	uint32_t victim_est = est;
+	for (int i = 0; i < PROXY_HOT_KEYS; ++i) {
+		struct proxy_hot_key *hot = &proxy->hot[i];
+		if (hot->key == NULL) {
+			victim = hot;
+			break;
+		}
+		uint32_t hot_est = proxy_sketch_get(proxy, hot->hash, false);
+		if (hot_est < victim_est) {
+			victim = hot;
+			victim_est = hot_est;
+		}
+	}
+	if (victim == NULL)
+		return NULL;
+	char *copy = (char *)malloc(key_len);
+	if (copy == NULL)
+		return NULL;
+	memcpy(copy, key, key_len);
+	free(victim->key);
+	memset(victim, 0, sizeof(struct proxy_hot_key));
+	victim->hash    = hash;
+	victim->key     = copy;
+	victim->key_len = key_len;
+	victim->gen     = ++proxy->hot_gen;
+	return victim;
+}
+
+static inline int
+proxy_hot_replicas(struct memcached_proxy *proxy)
+{
+	if (proxy->hot_replicas < proxy->backend_count - 1)
+		return proxy->hot_replicas;
+	return proxy->backend_count - 1;
+}
+
+/**
+ * Account read of the key. Read of a hot key is sent to one of backends,
+ * that hold copies, if copies are alive, and 'cas' is set to CAS of the
+ * owner, that is returned instead of the copy's one. Otherwise hot key is
+ * returned, so value from response is copied.
+ */
+static struct proxy_hot_key *
+proxy_hot_read(struct memcached_proxy *proxy, uint64_t hash,
+	       const char *key, uint16_t key_len, int32_t *idx,
+	       uint64_t *cas)
+{
+	proxy_sketch_decay(proxy);
+	uint32_t est = proxy_sketch_get(proxy, hash, true);
+	struct proxy_hot_key *hot = proxy_hot_find(proxy, hash, key, key_len);
+	if (hot == NULL && est >= proxy->hot_threshold)
+		hot = proxy_hot_insert(proxy, hash, key, key_len, est);
+	if (hot == NULL)
+		return NULL;
+	double now = fiber_time();
+	if (now < hot->copies_until) {
+		uint32_t shift = hot->next++ % (proxy_hot_replicas(proxy) + 1);
+		if (shift > 0) {
+			proxy->stat->proxy_hot_reads++;
+			*cas = hot->cas;
+		}
+		*idx = (*idx + shift) % proxy->backend_count;
+		return NULL;
+	}
+	if (now < hot->pending_until)
+		return NULL;
+	hot->pending_until = now + proxy->timeout;
+	return hot;
+}
+
+/* Write of hot key deletes its copies */
+static void
+proxy_hot_write(struct memcached_proxy *proxy, uint64_t hash,
+		const char *key, uint16_t key_len, int32_t idx)
+{
+	struct proxy_hot_key *hot = proxy_hot_find(proxy, hash, key, key_len);
+	if (hot == NULL)
+		return;
+	hot->gen = ++proxy->hot_gen;
+	hot->copies_until  = 0;
+	hot->pending_until = 0;
+	struct memcached_hdr hdr;
+	memset(&hdr, 0, sizeof(struct memcached_hdr));
+	hdr.magic   = MEMCACHED_BIN_REQUEST;
+	hdr.cmd     = MEMCACHED_BIN_CMD_DELETE;
+	hdr.key_len = mp_bswap_u16(key_len);
+	hdr.tot_len = mp_bswap_u32(key_len);
+	struct iovec iov[2];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len  = sizeof(struct memcached_hdr);
+	iov[1].iov_base = (char *)key;
+	iov[1].iov_len  = key_len;
+	size_t len = sizeof(struct memcached_hdr) + key_len;
+	for (int i = 1; i <= proxy_hot_replicas(proxy); ++i) {
+		struct proxy_backend *b =
+			&proxy->backends[(idx + i) % proxy->backend_count];
+		proxy_send_orphan(proxy, b, hash, MEMCACHED_BIN_CMD_DELETE,
+				  iov, 2, len);
+	}
+}
+
+/* Copy value of hot key from get response to replicas */
+static void
+proxy_hot_replicate(struct memcached_proxy *proxy, struct proxy_request *req)
+{
+	struct proxy_hot_key *hot = req->hot;
+	uint32_t gen = req->hot_gen;
+	/* key was written or replaced in the meantime */
+	if (hot->gen != gen)
+		return;
+	hot->pending_until = 0;
+	if (req->resp_len == 0 || hot->key_len > 256)
+		return;
+	/* slot may be reused, while copies are written */
+	char key[256];
+	uint16_t key_len = hot->key_len;
+	memcpy(key, hot->key, key_len);
+	const struct memcached_hdr *rhdr = (const struct memcached_hdr *)
+		req->resp;
+	if (rhdr->status != 0 || rhdr->ext_len != sizeof(uint32_t))
+		return;
+	const char *ext = req->resp + sizeof(struct memcached_hdr);
+	uint16_t rkey_len = mp_bswap_u16(rhdr->key_len);
+	uint32_t val_len  = mp_bswap_u32(rhdr->tot_len) - sizeof(uint32_t) -
+			    rkey_len;
+	struct {
+		uint32_t flags;
+		uint32_t expire;
+	} __attribute__((__packed__)) body;
+	memcpy(&body.flags, ext, sizeof(uint32_t));
+	body.expire = mp_bswap_u32(proxy->hot_ttl);
+	struct memcached_hdr hdr;
+	memset(&hdr, 0, sizeof(struct memcached_hdr));
+	hdr.magic   = MEMCACHED_BIN_REQUEST;
+	hdr.cmd     = MEMCACHED_BIN_CMD_SET;
+	hdr.ext_len = sizeof(body);
+	hdr.key_len = mp_bswap_u16(key_len);
+	hdr.tot_len = mp_bswap_u32(sizeof(body) + key_len + val_len);
+	struct iovec iov[4];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len  = sizeof(struct memcached_hdr);
+	iov[1].iov_base = &body;
+	iov[1].iov_len  = sizeof(body);
+	iov[2].iov_base = key;
+	iov[2].iov_len  = key_len;
+	iov[3].iov_base = (char *)ext + sizeof(uint32_t) + rkey_len;
+	iov[3].iov_len  = val_len;
+	size_t len = sizeof(struct memcached_hdr) + sizeof(body) +
+		     key_len + val_len;
+	int32_t idx = memcached_jump_hash(hot->hash, proxy->backend_count);
+	for (int i = 1; i <= proxy_hot_replicas(proxy); ++i) {
+		struct proxy_backend *b =
+			&proxy->backends[(idx + i) % proxy->backend_count];
+		proxy_send_orphan(proxy, b, hot->hash, MEMCACHED_BIN_CMD_SET,
+				  iov, 4, len);
+		proxy->stat->proxy_hot_copies++;
+	}
+	/* copies expire with granularity of second, don't read them late */
+	if (hot->gen == gen) {
+		hot->cas = rhdr->cas;
+		hot->copies_until = fiber_time() + proxy->hot_ttl / 2.0;
+	}
+}
+
+static inline int
+proxy_client_new(struct memcached_connection *con)
+{
+	struct proxy_client *cl = (struct proxy_client *)
+		calloc(1, sizeof(struct proxy_client));
+	if (cl == NULL) {
+		memcached_error_ENOMEM(sizeof(struct proxy_client),
+				       "proxy client");
+		return -1;
+	}
+	cl->cond = fiber_cond_new();
+	if (cl->cond == NULL) {
+		free(cl);
+		return -1;
+	}
+	con->proxy = cl;
+	return 0;
+}
+
+/**
+ * Requests with key are sent to backend, chosen by jump consistent
+ * hash of key, and aren't waited for. Responses are collected in
+ * memcached_proxy_collect() at the end of batch, so requests of a
+ * batch (for example, getkq's of multiget) are processed by backends
+ * in parallel. Flush is sent to every backend, other commands are
+ * processed locally.
+ */
+int
+memcached_proxy_process(struct memcached_connection *con)
+{
+	struct memcached_proxy *proxy = con->cfg->proxy;
+	struct memcached_hdr *h = con->hdr;
+	if (con->proxy == NULL && proxy_client_new(con) == -1)
+		return -1;
+	int cmd = proxy_forward_cmd(h->cmd);
+	bool flush = (h->cmd == MEMCACHED_BIN_CMD_FLUSH ||
+		      h->cmd == MEMCACHED_BIN_CMD_FLUSHQ);
+	if ((cmd == -1 || con->body.key_len == 0) && !flush) {
+		/* local command, keep order of replies */
+		if (memcached_proxy_collect(con) == -1)
+			return -1;
+		return memcached_bin_process(con);
+	}
+	if (con->cfg->sasl &&
+	    con->authentication_step != MEMCACHED_AUTH_OK) {
+		memcached_proxy_collect(con);
+		memcached_error(MEMCACHED_RES_AUTH_ERROR);
+		return -1;
+	}
+	if (flush) {
+		for (int i = 0; i < proxy->backend_count; ++i) {
+			bool silent = (i != proxy->backend_count - 1);
+			if (proxy_forward(con, &proxy->backends[i],
+					  proxy->backends[i].next++,
+					  MEMCACHED_BIN_CMD_FLUSH,
+					  silent, 0) == NULL)
+				goto error;
+		}
+		/* copies are flushed too */
+		for (int i = 0; i < PROXY_HOT_KEYS; ++i) {
+			proxy->hot[i].gen = ++proxy->hot_gen;
+			proxy->hot[i].copies_until = 0;
+		}
+		return 0;
+	}
+	const char *key = con->body.key;
+	uint16_t key_len = con->body.key_len;
+	uint64_t hash = proxy_key_hash(key, key_len);
+	int32_t idx = memcached_jump_hash(hash, proxy->backend_count);
+	struct proxy_hot_key *hot = NULL;
+	uint64_t copy_cas = 0;
+	if (proxy_hot_replicas(proxy) > 0) {
+		if (proxy_is_read(cmd))
+			hot = proxy_hot_read(proxy, hash, key, key_len, &idx,
+					     &copy_cas);
+		else
+			proxy_hot_write(proxy, hash, key, key_len, idx);
+	}
+	struct proxy_request *req = proxy_forward(con, &proxy->backends[idx],
+						  hash, cmd, false, copy_cas);
+	if (req == NULL)
+		goto error;
+	if (hot != NULL) {
+		req->hot     = hot;
+		req->hot_gen = hot->gen;
+	}
+	return 0;
+error:
+	memcached_proxy_collect(con);
+	return -1;
+}
+
+/**
+ * Wait for responses of pending requests and write them into output
+ * buffer in the order of requests.
+ */
+int
+memcached_proxy_collect(struct memcached_connection *con)
+{
+	struct proxy_client *cl = con->proxy;
+	if (cl == NULL)
+		return 0;
+	struct memcached_proxy *proxy = con->cfg->proxy;
+	struct obuf *out = con->out;
+	int rc = 0;
+	double deadline = fiber_time() + proxy->timeout;
+	struct proxy_request *req = NULL;
+	while ((req = cl->pending.first) != NULL) {
+		while (!req->done && fiber_time() < deadline)
+			fiber_cond_wait_timeout(cl->cond,
+						deadline - fiber_time());
+		proxy_queue_shift(&cl->pending, next_in_client);
+		const char *resp = req->resp;
+		size_t resp_len  = req->resp_len;
+		char errbuf[sizeof(struct memcached_hdr) + 256];
+		if (!req->done) {
+			/* backend is too slow, reader will free request */
+			box_error_clear();
+			proxy->stat->proxy_errors++;
+			resp_len = proxy_error_encode(errbuf, req->cmd,
+						      req->opaque,
+						      "Backend timeout");
+			resp = errbuf;
+			req->client = NULL;
+			req = NULL;
+		}
+		if (req != NULL && req->hot != NULL)
+			proxy_hot_replicate(proxy, req);
+		if (resp_len > 0 && rc == 0) {
+			if (obuf_dup(out, resp, resp_len) != resp_len) {
+				memcached_error_ENOMEM(resp_len, "obuf");
+				rc = -1;
+			}
+		}
+		if (req != NULL)
+			proxy_request_delete(proxy, req);
+	}
+	return rc;
+}
+
+/**
+ * Connection is closed, requests in flight are left to backend readers.
+ */
+void
+memcached_proxy_detach(struct memcached_connection *con)
+{
+	struct proxy_client *cl = con->proxy;
+	if (cl == NULL)
+		return;
+	struct memcached_proxy *proxy = con->cfg->proxy;
+	struct proxy_request *req = NULL;
+	while ((req = cl->pending.first) != NULL) {
+		proxy_queue_shift(&cl->pending, next_in_client);
+		if (req->done)
+			proxy_request_delete(proxy, req);
+		else
+			req->client = NULL;
+	}
+	fiber_cond_delete(cl->cond);
+	free(cl);
+	con->proxy = NULL;
+}
+
+/**
+ * Parse comma separated list of 'host:port' backends
+ */
+struct memcached_proxy *
+memcached_proxy_new(const char *backends)
+{
+	struct memcached_proxy *proxy = (struct memcached_proxy *)
+		calloc(1, sizeof(struct memcached_proxy));
+	char *list = strdup(backends);
+	if (proxy == NULL || list == NULL)
+		goto error_mem;
+	proxy->conn_count    = 4;
+	proxy->timeout       = 1.0;
+	proxy->hot_threshold = 10000;
+	proxy->hot_ttl       = 2;
+	int count = 1;
+	for (const char *pos = list; *pos; ++pos)
+		count += (*pos == ',');
+	proxy->backends = (struct proxy_backend *)
+		calloc(count, sizeof(struct proxy_backend));
+	if (proxy->backends == NULL)
+		goto error_mem;
+	char *save = NULL;
+	for (char *tok = strtok_r(list, ", ", &save); tok != NULL;
+	     tok = strtok_r(NULL, ", ", &save)) {
+		char *sep = strrchr(tok, ':');
+		if (sep == NULL || sep == tok || sep[1] == '\0') {
+			say_error("Bad memcached backend '%s', expected "
+				  "'host:port'", tok);
+			goto error;
+		}
+		*sep = '\0';
+		struct proxy_backend *b = &proxy->backends[proxy->backend_count];
+		b->proxy = proxy;
+		b->host  = strdup(tok);
+		b->port  = strdup(sep + 1);
+		proxy->backend_count++;
+		if (b->host == NULL || b->port == NULL)
+			goto error_mem;
+	}
+	if (proxy->backend_count == 0) {
+		say_error("Empty list of memcached backends");
+		goto error;
+	}
+	free(list);
+	return proxy;
+error_mem:
+	say_syserror("failed to allocate memory for memcached proxy");
+error:
+	free(list);
+	memcached_proxy_delete(proxy);
+	return NULL;
+}
+
+void
+memcached_proxy_delete(struct memcached_proxy *proxy)
+{
+	if (proxy == NULL)
+		return;
+	memcached_proxy_stop(proxy);
+	for (int i = 0; i < proxy->backend_count; ++i) {
+		free(proxy->backends[i].host);
+		free(proxy->backends[i].port);
+	}
+	free(proxy->backends);
+	for (int i = 0; i < PROXY_HOT_KEYS; ++i)
+		free(proxy->hot[i].key);
+	free(proxy);
+}
+
+void
+memcached_proxy_set_connections(struct memcached_proxy *proxy, int count)
+{
+	if (proxy->running) {
+		say_error("Can't change count of backend connections of "
+			  "running proxy");
+		return;
+	}
+	proxy->conn_count = count;
+}
+
+void
+memcached_proxy_set_timeout(struct memcached_proxy *proxy, double timeout)
+{
+	proxy->timeout = timeout;
+}
+
+void
+memcached_proxy_set_hot(struct memcached_proxy *proxy, int replicas,
+			uint32_t threshold, uint32_t ttl)
+{
+	if (replicas >= 0)
+		proxy->hot_replicas  = replicas;
+	if (threshold > 0)
+		proxy->hot_threshold = threshold;
+	if (ttl > 0)
+		proxy->hot_ttl       = ttl;
+}
+
+int
+memcached_proxy_start(struct memcached_proxy *proxy,
+		      struct memcached_stat *stat)
+{
+	if (proxy->running)
+		return 0;
+	proxy->stat = stat;
+	mempool_create(&proxy->req_pool, cord_slab_cache(),
+		       sizeof(struct proxy_request));
+	for (int i = 0; i < proxy->backend_count; ++i) {
+		struct proxy_backend *b = &proxy->backends[i];
+		b->conns = (struct proxy_conn *)calloc(proxy->conn_count,
+						       sizeof(struct proxy_conn));
+		if (b->conns == NULL) {
+			say_syserror("failed to allocate memory for memcached "
+				     "proxy");
+			goto error;
+		}
+		for (int j = 0; j < proxy->conn_count; ++j) {
+			struct proxy_conn *c = &b->conns[j];
+			c->backend = b;
+			c->fd      = -1;
+			ibuf_create(&c->in, cord_slab_cache(), PROXY_READAHEAD);
+			c->latch   = box_latch_new();
+			char name[128];
+			snprintf(name, 128, "__mc_proxy_%s:%s", b->host, b->port);
+			c->reader  = fiber_new(name, proxy_conn_loop);
+			if (c->reader == NULL)
+				goto error;
+			fiber_set_joinable(c->reader, true);
+			fiber_start(c->reader, c);
+		}
+	}
+	proxy->running = true;
+	return 0;
+error:
+	proxy->running = true;
+	memcached_proxy_stop(proxy);
+	return -1;
+}
+
+void
+memcached_proxy_stop(struct memcached_proxy *proxy)
+{
+	if (!proxy->running)
+		return;
+	for (int i = 0; i < proxy->backend_count; ++i) {
+		struct proxy_backend *b = &proxy->backends[i];
+		if (b->conns == NULL)
+			continue;
+		for (int j = 0; j < proxy->conn_count; ++j) {
+			struct proxy_conn *c = &b->conns[j];
+			if (c->reader != NULL) {
+				fiber_cancel(c->reader);
+				fiber_join(c->reader);
+			}
+			if (c->latch != NULL)
+				box_latch_delete(c->latch);
+			ibuf_destroy(&c->in);
+		}
+		free(b->conns);
+		b->conns = NULL;
+	}
+	mempool_destroy(&proxy->req_pool);
+	proxy->running = false;
+}
@@ -0,0 +1,45 @@
+#ifndef   PROXY_H_INCLUDED
+#define   PROXY_H_INCLUDED
+
+#include <stdint.h>
+
+struct memcached_connection;
+struct memcached_proxy;
+struct memcached_stat;
+
+struct memcached_proxy *
+memcached_proxy_new(const char *backends);
+
+void
+memcached_proxy_delete(struct memcached_proxy *proxy);
+
+void
+memcached_proxy_set_connections(struct memcached_proxy *proxy, int count);
+
+void
+memcached_proxy_set_timeout(struct memcached_proxy *proxy, double timeout);
+
+void
+memcached_proxy_set_hot(struct memcached_proxy *proxy, int replicas,
+			uint32_t threshold, uint32_t ttl);
+
+int
+memcached_proxy_start(struct memcached_proxy *proxy,
+		      struct memcached_stat *stat);
+
+void
+memcached_proxy_stop(struct memcached_proxy *proxy);
+
+int
+memcached_proxy_process(struct memcached_connection *con);
+
+int
+memcached_proxy_collect(struct memcached_connection *con);
+
+void
+memcached_proxy_detach(struct memcached_connection *con);
+
+int32_t
+memcached_jump_hash(uint64_t key, int32_t buckets);
+
+#endif /* PROXY_H_INCLUDED */
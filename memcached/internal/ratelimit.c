@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <tarantool/module.h>
+
+#include "memcached.h"
+#include "constants.h"
+#include "mc_sasl.h"
+#include "ratelimit.h"
+
+/**
+ * Rate limiting: every request takes a token from ops buckets and its
+ * size from bytes buckets of the connection and of the SASL user.
+ * Connection in debt isn't read, until buckets are refilled, so
+ * a runaway client is slowed down instead of getting errors.
+ */
+
+/* Buckets of a SASL user, shared by all connections of the user */
+struct memcached_user_limit {
+	struct memcached_user_limit *next;
+	char                        *name;
+	struct memcached_limit       limit;
+};
+
+bool
+memcached_limit_enabled(struct memcached_service *p)
+{
+	return p->rates.conn_ops > 0 || p->rates.conn_bytes > 0 ||
+	       p->rates.user_ops > 0 || p->rates.user_bytes > 0;
+}
+
+static inline void
+bucket_take(struct memcached_bucket *b, double rate, double amount,
+	    double now)
+{
+	if (rate <= 0)
+		return;
+	b->tokens += (now - b->last) * rate;
+	if (b->tokens > rate)
+		b->tokens = rate;
+	b->last = now;
+	b->tokens -= amount;
+}
+
+/* Time to wait, until the bucket is out of debt */
+static inline double
+bucket_debt(struct memcached_bucket *b, double rate)
+{
+	if (rate <= 0 || b->tokens >= 0)
+		return 0;
+	return -b->tokens / rate;
+}
+
+/* Find buckets of the authenticated user */
+static void
+memcached_limit_user(struct memcached_connection *con)
+{
+	struct memcached_service *p = con->cfg;
+	if (p->sasl == false || con->user_limit != NULL ||
+	    con->authentication_step != MEMCACHED_AUTH_OK)
+		return;
+	const char *name = memcached_sasl_username(con);
+	if (name == NULL)
+		return;
+	struct memcached_user_limit *user = p->user_limits;
+	for (; user != NULL; user = user->next) {
+		if (strcmp(user->name, name) == 0)
+			break;
+	}
+	if (user == NULL) {
+		user = (struct memcached_user_limit *)
+			calloc(1, sizeof(struct memcached_user_limit));
+		if (user == NULL || (user->name = strdup(name)) == NULL) {
+			say_syserror("failed to allocate memory for user limit");
+			free(user);
+			return;
+		}
+		user->next = p->user_limits;
+		p->user_limits = user;
+	}
+	con->user_limit = user;
+}
+
+/* Refill buckets and take 'ops' and 'bytes' from them */
+static void
+memcached_limit_take(struct memcached_connection *con, double ops,
+		     double bytes)
+{
+	struct memcached_rates *r = &con->cfg->rates;
+	double now = fiber_clock();
+	bucket_take(&con->limit.ops,   r->conn_ops,   ops,   now);
+	bucket_take(&con->limit.bytes, r->conn_bytes, bytes, now);
+	if (con->user_limit != NULL) {
+		struct memcached_limit *user = &con->user_limit->limit;
+		bucket_take(&user->ops,   r->user_ops,   ops,   now);
+		bucket_take(&user->bytes, r->user_bytes, bytes, now);
+	}
+}
+
+/* Take processed request from buckets */
+void
+memcached_limit_charge(struct memcached_connection *con, size_t bytes)
+{
+	if (!memcached_limit_enabled(con->cfg))
+		return;
+	memcached_limit_user(con);
+	memcached_limit_take(con, 1, bytes);
+}
+
+static double
+memcached_limit_debt(struct memcached_connection *con)
+{
+	struct memcached_rates *r = &con->cfg->rates;
+	double debt = bucket_debt(&con->limit.ops, r->conn_ops);
+	double d = bucket_debt(&con->limit.bytes, r->conn_bytes);
+	if (d > debt) debt = d;
+	if (con->user_limit != NULL) {
+		struct memcached_limit *user = &con->user_limit->limit;
+		d = bucket_debt(&user->ops, r->user_ops);
+		if (d > debt) debt = d;
+		d = bucket_debt(&user->bytes, r->user_bytes);
+		if (d > debt) debt = d;
+	}
+	return debt;
+}
+
+/* Batch of requests is cut, when a bucket is in debt */
+bool
+memcached_limit_exceeded(struct memcached_connection *con)
+{
+	return memcached_limit_enabled(con->cfg) &&
+	       memcached_limit_debt(con) > 0;
+}
+
+/**
+ * Delay the next read, until buckets are out of debt. Buckets of a
+ * user are shared, so the debt is checked again after the sleep.
+ */
+void
+memcached_limit_wait(struct memcached_connection *con)
+{
+	if (!memcached_limit_enabled(con->cfg))
+		return;
+	double debt = memcached_limit_debt(con);
+	if (debt <= 0)
+		return;
+	double start = fiber_clock();
+	con->cfg->stat.throttled++;
+	while (debt > 0) {
+		fiber_sleep(debt);
+		memcached_limit_take(con, 0, 0);
+		debt = memcached_limit_debt(con);
+	}
+	con->cfg->stat.throttled_usec += (fiber_clock() - start) * 1000000;
+}
+
+void
+memcached_limit_free_users(struct memcached_service *p)
+{
+	while (p->user_limits != NULL) {
+		struct memcached_user_limit *user = p->user_limits;
+		p->user_limits = user->next;
+		free(user->name);
+		free(user);
+	}
+}
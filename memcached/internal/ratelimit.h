@@ -0,0 +1,46 @@
+#ifndef   RATELIMIT_H_INCLUDED
+#define   RATELIMIT_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct memcached_connection;
+struct memcached_service;
+
+/* Token bucket, it holds up to one second of the rate */
+struct memcached_bucket {
+	double tokens;
+	double last;
+};
+
+/* Ops and bytes buckets, of a connection or of a SASL user */
+struct memcached_limit {
+	struct memcached_bucket ops;
+	struct memcached_bucket bytes;
+};
+
+/* Rates per connection and per SASL user, 0 is unlimited */
+struct memcached_rates {
+	double conn_ops;
+	double conn_bytes;
+	double user_ops;
+	double user_bytes;
+};
+
+bool
+memcached_limit_enabled(struct memcached_service *p);
+
+void
+memcached_limit_charge(struct memcached_connection *con, size_t bytes);
+
+bool
+memcached_limit_exceeded(struct memcached_connection *con);
+
+void
+memcached_limit_wait(struct memcached_connection *con);
+
+void
+memcached_limit_free_users(struct memcached_service *p);
+
+#endif /* RATELIMIT_H_INCLUDED */
@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <tarantool/module.h>
+
+#include "utils.h"
+#include "sliding.h"
+
+/**
+ * Last access times of items with sliding TTL. They're kept in module
+ * memory, so reads don't write tuples. The table is lossy: a slot
+ * holds hash of the key and the time in seconds, a key, that takes the
+ * slot of another one, makes it forget its last access. Then the item
+ * expires by TTL of its last write, as without sliding, never earlier.
+ */
+
+#define SLIDING_SLOTS (1 << 18)
+
+struct sliding_slot {
+	uint32_t hash;
+	uint32_t time;
+};
+
+struct memcached_sliding {
+	struct sliding_slot slots[SLIDING_SLOTS];
+};
+
+struct memcached_sliding *
+memcached_sliding_new()
+{
+	struct memcached_sliding *s = (struct memcached_sliding *)
+		calloc(1, sizeof(struct memcached_sliding));
+	if (s == NULL)
+		say_syserror("failed to allocate memory for access times");
+	return s;
+}
+
+void
+memcached_sliding_delete(struct memcached_sliding *s)
+{
+	free(s);
+}
+
+void
+memcached_sliding_touch(struct memcached_sliding *s, const char *key,
+			uint32_t key_len, uint64_t now)
+{
+	uint32_t hash = memcached_crc32(key, key_len);
+	struct sliding_slot *slot = &s->slots[hash % SLIDING_SLOTS];
+	slot->hash = hash;
+	slot->time = (uint32_t )(now / 1000000);
+}
+
+/* Last access in usec, 0 if it isn't known */
+uint64_t
+memcached_sliding_last(struct memcached_sliding *s, const char *key,
+		       uint32_t key_len)
+{
+	uint32_t hash = memcached_crc32(key, key_len);
+	struct sliding_slot *slot = &s->slots[hash % SLIDING_SLOTS];
+	if (slot->hash != hash || slot->time == 0)
+		return 0;
+	return (uint64_t )slot->time * 1000000;
+}
@@ -0,0 +1,22 @@
+#ifndef   SLIDING_H_INCLUDED
+#define   SLIDING_H_INCLUDED
+
+#include <stdint.h>
+
+struct memcached_sliding;
+
+struct memcached_sliding *
+memcached_sliding_new();
+
+void
+memcached_sliding_delete(struct memcached_sliding *s);
+
+void
+memcached_sliding_touch(struct memcached_sliding *s, const char *key,
+			uint32_t key_len, uint64_t now);
+
+uint64_t
+memcached_sliding_last(struct memcached_sliding *s, const char *key,
+		       uint32_t key_len);
+
+#endif /* SLIDING_H_INCLUDED */
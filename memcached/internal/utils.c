@@ -83,6 +83,27 @@ memcached_binary_header_dump(struct memcached_hdr *hdr)
 	say_debug("cas:       %" PRIu64,         (uint64_t )mp_bswap_u64(hdr->cas));
 }
 
+/* CRC-32 (IEEE 802.3), table is built on first use */
+uint32_t
+memcached_crc32(const char *buf, uint32_t len)
+{
+	static uint32_t table[256];
+	static bool table_ready = false;
+	if (!table_ready) {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int j = 0; j < 8; ++j)
+				c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+			table[i] = c;
+		}
+		table_ready = true;
+	}
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint32_t i = 0; i < len; ++i)
+		crc = table[(crc ^ (uint8_t )buf[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+}
+
 /** Find a string in an array of strings.
  *
  * @param haystack  Array of strings. Either NULL
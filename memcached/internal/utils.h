@@ -18,6 +18,9 @@ safe_strtoull(const char *begin, const char *end, uint64_t *out);
 void
 memcached_binary_header_dump(struct memcached_hdr *hdr);
 
+uint32_t
+memcached_crc32(const char *buf, uint32_t len);
+
 /* Macros to define enum and corresponding strings. */
 #define ENUM0_MEMBER(s, ...) s,
 #define ENUM_MEMBER(s, v, ...) s = v,
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <tarantool/module.h>
+#include <msgpuck.h>
+
+#include "memcached.h"
+#include "memcached_layer.h"
+#include "constants.h"
+#include "error.h"
+#include "utils.h"
+#include "vbucket.h"
+
+static const char *vbucket_state_strs[MEMCACHED_VBUCKET_MAX] = {
+	[MEMCACHED_VBUCKET_DEAD]   = "dead",
+	[MEMCACHED_VBUCKET_ACTIVE] = "active",
+};
+
+/**
+ * Split key space into 'count' vbuckets, all of them are owned by the
+ * instance. Zero count disables vbuckets.
+ */
+int
+memcached_vbucket_configure(struct memcached_service *p, uint32_t count)
+{
+	if (count > MEMCACHED_VBUCKET_COUNT_MAX) {
+		say_error("Count of vbuckets must be less than %d",
+			  MEMCACHED_VBUCKET_COUNT_MAX);
+		return -1;
+	}
+	uint8_t *vbuckets = NULL;
+	if (count > 0) {
+		vbuckets = (uint8_t *)malloc(count);
+		if (vbuckets == NULL) {
+			say_syserror("failed to allocate memory for vbuckets");
+			return -1;
+		}
+		memset(vbuckets, MEMCACHED_VBUCKET_ACTIVE, count);
+	}
+	free(p->vbuckets);
+	p->vbuckets      = vbuckets;
+	p->vbucket_count = count;
+	return 0;
+}
+
+int
+memcached_vbucket_set(struct memcached_service *p, uint32_t vb,
+		      enum memcached_vbucket_state state)
+{
+	if (vb >= p->vbucket_count || state >= MEMCACHED_VBUCKET_MAX)
+		return -1;
+	p->vbuckets[vb] = state;
+	return 0;
+}
+
+int
+memcached_vbucket_get(struct memcached_service *p, uint32_t vb)
+{
+	if (vb >= p->vbucket_count)
+		return -1;
+	return p->vbuckets[vb];
+}
+
+/* Same mapping, as used by vbucket-aware clients */
+uint32_t
+memcached_vbucket_of(struct memcached_service *p, const char *key,
+		     uint32_t key_len)
+{
+	uint32_t crc = memcached_crc32(key, key_len);
+	return ((crc >> 16) & 0x7fff) % p->vbucket_count;
+}
+
+static inline bool
+memcached_vbucket_keyed(uint8_t cmd)
+{
+	switch (cmd) {
+	case MEMCACHED_BIN_CMD_GET:
+	case MEMCACHED_BIN_CMD_GETQ:
+	case MEMCACHED_BIN_CMD_GETK:
+	case MEMCACHED_BIN_CMD_GETKQ:
+	case MEMCACHED_BIN_CMD_SET:
+	case MEMCACHED_BIN_CMD_SETQ:
+	case MEMCACHED_BIN_CMD_ADD:
+	case MEMCACHED_BIN_CMD_ADDQ:
+	case MEMCACHED_BIN_CMD_REPLACE:
+	case MEMCACHED_BIN_CMD_REPLACEQ:
+	case MEMCACHED_BIN_CMD_DELETE:
+	case MEMCACHED_BIN_CMD_DELETEQ:
+	case MEMCACHED_BIN_CMD_INCR:
+	case MEMCACHED_BIN_CMD_INCRQ:
+	case MEMCACHED_BIN_CMD_DECR:
+	case MEMCACHED_BIN_CMD_DECRQ:
+	case MEMCACHED_BIN_CMD_APPEND:
+	case MEMCACHED_BIN_CMD_APPENDQ:
+	case MEMCACHED_BIN_CMD_PREPEND:
+	case MEMCACHED_BIN_CMD_PREPENDQ:
+	case MEMCACHED_BIN_CMD_TOUCH:
+	case MEMCACHED_BIN_CMD_GAT:
+	case MEMCACHED_BIN_CMD_GATQ:
+	case MEMCACHED_BIN_CMD_GATK:
+	case MEMCACHED_BIN_CMD_GATKQ:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Reject request for the key of vbucket, that isn't owned by instance.
+ * Vbucket from request header must match the key, zero is accepted from
+ * clients, that aren't aware of vbuckets.
+ */
+int
+memcached_vbucket_check(struct memcached_connection *con)
+{
+	struct memcached_service *p = con->cfg;
+	if (p->vbuckets == NULL || !memcached_vbucket_keyed(con->hdr->cmd))
+		return 0;
+	uint32_t vb = memcached_vbucket_of(p, con->body.key,
+					   con->body.key_len);
+	uint16_t req_vb = mp_bswap_u16(con->hdr->reserved);
+	if ((req_vb != 0 && req_vb != vb) ||
+	    p->vbuckets[vb] != MEMCACHED_VBUCKET_ACTIVE) {
+		p->stat.vbucket_rejects++;
+		memcached_error(MEMCACHED_RES_VBUCKET_BADVAL);
+		return -1;
+	}
+	return 0;
+}
+
+/* count of items, scanned by 'stats vbucket' between yields */
+#define MEMCACHED_VBUCKET_STAT_BATCH 1000
+
+/**
+ * 'stats vbucket': state and count of live items of every vbucket.
+ * Items are counted by a scan of the space, that yields every
+ * MEMCACHED_VBUCKET_STAT_BATCH items, so serving isn't blocked. Like
+ * 'stats dump', the count is consistent per batch.
+ */
+int
+memcached_vbucket_stat(struct memcached_connection *con, stat_func_t append)
+{
+	struct memcached_service *p = con->cfg;
+	if (p->vbuckets == NULL) {
+		memcached_error_NOT_SUPPORTED("stat vbucket without vbuckets");
+		return -1;
+	}
+	uint32_t count = p->vbucket_count;
+	uint32_t *items = (uint32_t *)calloc(count, sizeof(uint32_t));
+	if (items == NULL) {
+		memcached_error_ENOMEM(count * sizeof(uint32_t), "vbuckets");
+		return -1;
+	}
+	int rc = -1, in_batch = 0;
+	uint32_t part = 0;
+	box_iterator_t *iter = memcached_partition_iterator(p, part);
+	if (iter == NULL)
+		goto finish;
+	for (;;) {
+		box_tuple_t *tpl = NULL;
+		if (box_iterator_next(iter, &tpl) == -1)
+			goto finish;
+		if (tpl == NULL && ++part < p->partition_count) {
+			box_iterator_free(iter);
+			iter = memcached_partition_iterator(p, part);
+			if (iter == NULL)
+				goto finish;
+			continue;
+		}
+		if (tpl == NULL)
+			break;
+		if (!is_expired_tuple(p, tpl)) {
+			uint32_t klen = 0;
+			const char *kpos = box_tuple_field(tpl, 0);
+			kpos = mp_decode_str(&kpos, &klen);
+			items[memcached_vbucket_of(p, kpos, klen)]++;
+		}
+		if (++in_batch < MEMCACHED_VBUCKET_STAT_BATCH)
+			continue;
+		in_batch = 0;
+		fiber_sleep(0);
+		/* vbuckets may be reconfigured meanwhile */
+		if (p->vbuckets == NULL || p->vbucket_count != count) {
+			memcached_error_SERVER_ERROR("vbuckets are reconfigured");
+			goto finish;
+		}
+	}
+	for (uint32_t vb = 0; vb < count; ++vb) {
+		char name[16];
+		snprintf(name, 16, "vb_%" PRIu32, vb);
+		if (append(con, name, "%s items=%" PRIu32,
+			   vbucket_state_strs[p->vbuckets[vb]],
+			   items[vb]) == -1)
+			goto finish;
+	}
+	if (append(con, NULL, NULL) == -1)
+		goto finish;
+	rc = 0;
+finish:
+	if (iter != NULL)
+		box_iterator_free(iter);
+	free(items);
+	return rc;
+}
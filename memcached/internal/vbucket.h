@@ -0,0 +1,37 @@
+#ifndef   VBUCKET_H_INCLUDED
+#define   VBUCKET_H_INCLUDED
+
+#include <stdint.h>
+
+struct memcached_service;
+struct memcached_connection;
+
+enum memcached_vbucket_state {
+	MEMCACHED_VBUCKET_DEAD   = 0x00,
+	MEMCACHED_VBUCKET_ACTIVE = 0x01,
+	MEMCACHED_VBUCKET_MAX
+};
+
+#define MEMCACHED_VBUCKET_COUNT_MAX 0x8000
+
+int
+memcached_vbucket_configure(struct memcached_service *p, uint32_t count);
+
+int
+memcached_vbucket_set(struct memcached_service *p, uint32_t vb,
+		      enum memcached_vbucket_state state);
+
+int
+memcached_vbucket_get(struct memcached_service *p, uint32_t vb);
+
+uint32_t
+memcached_vbucket_of(struct memcached_service *p, const char *key,
+		     uint32_t key_len);
+
+int
+memcached_vbucket_check(struct memcached_connection *con);
+
+int
+memcached_vbucket_stat(struct memcached_connection *con, stat_func_t append);
+
+#endif /* VBUCKET_H_INCLUDED */
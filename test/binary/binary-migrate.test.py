@@ -0,0 +1,132 @@
+import os
+import sys
+import time
+import yaml
+import shutil
+import socket
+import inspect
+import tempfile
+import traceback
+import subprocess
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_connection import MemcachedBinaryConnection
+from internal.memcached_connection import STATUS, COMMANDS
+
+def iequal(left, right, level = 1):
+    if (left != right):
+        tb = traceback.extract_stack()[-(level + 1)]
+        print "Error on line %s:%d: %s not equal %s" % (tb[0], tb[1],
+                repr(left), repr(right))
+        return False
+    return True
+
+def admin(cmd):
+    return yaml.load(server.admin(cmd, silent=True))[0]
+
+def free_port():
+    sock = socket.socket()
+    sock.bind(('127.0.0.1', 0))
+    port = sock.getsockname()[1]
+    sock.close()
+    return port
+
+def wait(cond):
+    for _ in xrange(100):
+        if cond():
+            return True
+        time.sleep(0.05)
+    return False
+
+# Target node is a separate tarantool, where the migrated vbucket is dead,
+# main server of the suite is the source
+script = """
+local memcached = require('memcached')
+local listen, dir, vb = arg[1], arg[2], tonumber(arg[3])
+box.cfg{ listen = listen, work_dir = dir, wal_mode = 'none',
+         log = 'tarantool.log' }
+box.schema.user.grant('guest', 'read,write,execute', 'universe')
+local inst = memcached.create('mig', '127.0.0.1:0', { vbuckets = 4 })
+inst:vbucket(vb, 'dead')
+function items()
+    local count = 0
+    for _, space in ipairs(inst.spaces) do
+        count = count + space:len()
+    end
+    return count
+end
+print(inst.listener:name().port)
+io.stdout:flush()
+"""
+
+admin("mig = require('memcached').create('mig', '127.0.0.1:0', " +
+      "{ vbuckets = 4, expire_enabled = false })")
+mc = MemcachedBinaryConnection("127.0.0.1", admin("mig.listener:name().port"))
+
+keys = ['key-%d' % i for i in xrange(40)]
+vb = admin("mig:vbucket_of('key-0')")
+moved = [key for key in keys if admin("mig:vbucket_of('%s')" % key) == vb]
+kept = [key for key in keys if key not in moved]
+for key in keys:
+    mc.set(key, 'old-' + key)
+
+binary = admin("arg[-1]")
+cwd = admin("require('fio').cwd()")
+env = dict(os.environ)
+env['LUA_PATH'] = admin("package.path")
+env['LUA_CPATH'] = admin("package.cpath")
+
+workdir = tempfile.mkdtemp(prefix='mc-migrate-')
+path = os.path.join(workdir, 'target.lua')
+with open(path, 'w') as f:
+    f.write(script)
+
+target_uri = '127.0.0.1:%d' % free_port()
+target = subprocess.Popen([binary, path, target_uri, workdir, str(vb)],
+                          cwd=cwd, env=env, stdout=subprocess.PIPE)
+tmc = MemcachedBinaryConnection("127.0.0.1", int(target.stdout.readline()))
+admin("tgt = require('net.box').connect('%s')" % target_uri)
+
+print("""#------------------------# vbucket is copied, while it's served #------------------------#""")
+
+iequal(tmc.get(moved[0])[0]['status'], STATUS['VBUCKET_BADVAL'])
+
+admin("migrated = nil")
+admin("require('fiber').create(function() " +
+      "migrated = mig:migrate(%d, '%s', { page = 1, delay = 0.1 }) " %
+      (vb, target_uri) + "end)")
+iequal(wait(lambda: admin("tgt:eval('return items()')") > 0), True)
+
+# changes, made after the copy started, are sent by catch-up
+for key in moved[:-1]:
+    iequal(mc.set(key, 'new-' + key)[0]['status'], STATUS['OK'])
+iequal(mc.delete(moved[-1])[0]['status'], STATUS['OK'])
+
+iequal(wait(lambda: admin("migrated") is not None), True)
+
+print("""#------------------------# target owns the vbucket #------------------------#""")
+
+iequal(admin("mig:vbucket(%d)" % vb), 'dead')
+iequal(admin("tgt:eval(\"return require('memcached').get('mig')" +
+             ":vbucket(%d)\")" % vb), 'active')
+iequal(mc.get(moved[0])[0]['status'], STATUS['VBUCKET_BADVAL'])
+
+for key in moved[:-1]:
+    iequal(tmc.get(key)[0]['val'], 'new-' + key)
+iequal(tmc.get(moved[-1])[0]['status'], STATUS['KEY_ENOENT'])
+iequal(admin("tgt:eval('return items()')"), len(moved) - 1)
+
+print("""#------------------------# source purges the vbucket #------------------------#""")
+
+iequal(admin("mig.spaces[1]:len()"), len(kept))
+for key in kept:
+    iequal(mc.get(key)[0]['val'], 'old-' + key)
+
+admin("tgt:close()")
+target.terminate()
+target.wait()
+shutil.rmtree(workdir)
+
+sys.path = saved_path
@@ -0,0 +1,131 @@
+import os
+import sys
+import yaml
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_connection import MemcachedBinaryConnection
+from internal.memcached_connection import STATUS, COMMANDS
+
+def iequal(left, right, level = 1):
+    if (left != right):
+        tb = traceback.extract_stack()[-(level + 1)]
+        print "Error on line %s:%d: %s not equal %s" % (tb[0], tb[1],
+                repr(left), repr(right))
+        return False
+    return True
+
+def admin(cmd):
+    return yaml.load(server.admin(cmd, silent=True))[0]
+
+def create(name, opts = '{}'):
+    admin("require('memcached').create('%s', '127.0.0.1:0', %s)" % (name, opts))
+    # let proxy connect to backends
+    admin("require('fiber').sleep(0.1)")
+    return admin("require('memcached').get('%s').listener:name().port" % name)
+
+def items(name):
+    return admin("box.space.__mc_%s:len()" % name)
+
+def fibers(name):
+    return admin("local names = {} " +
+        "for _, f in pairs(require('fiber').info()) do " +
+        "if f.name:find('^__mc_%s_') then table.insert(names, f.name) end " % name +
+        "end table.sort(names) return names")
+
+backends = [create('backend1'), create('backend2')]
+port = create('router', "{ proxy = '127.0.0.1:%d,127.0.0.1:%d' }" % tuple(backends))
+
+mc = MemcachedBinaryConnection("127.0.0.1", port)
+
+print("""#-------------------------# keys are routed by hash #-------------------------#""")
+
+for i in xrange(100):
+    mc.set('key-%d' % i, 'value-%d' % i, flags=i)
+
+for i in xrange(100):
+    res = mc.get('key-%d' % i)[0]
+    iequal(res.get('val', None), 'value-%d' % i)
+    iequal(res.get('flags', None), i)
+
+iequal(items('backend1') + items('backend2'), 100)
+iequal(items('backend1') > 0, True)
+iequal(items('backend2') > 0, True)
+iequal(items('router'), 0)
+
+print("""#----------------------# pipelined multiget is ordered #----------------------#""")
+
+for i in xrange(100):
+    mc.getkq('key-%d' % i, nosend=True)
+mc.getkq('no-such-key', nosend=True)
+res = mc.noop()
+iequal(len(res), 101)
+iequal([r.get('key', None) for r in res[:100]],
+       ['key-%d' % i for i in xrange(100)])
+iequal(res[100]['op'], COMMANDS['noop'][0])
+
+print("""#-----------------------# flush is sent to every backend #-----------------------#""")
+
+mc.flush()
+iequal(mc.get('key-1')[0]['status'], STATUS['KEY_ENOENT'])
+
+stat = mc.stat()
+iequal(int(stat['proxy_forwarded']) > 0, True)
+iequal(int(stat['proxy_errors']), 0)
+
+print("""#--------------------# hot key is read from copies #--------------------#""")
+
+port = create('router3', "{ proxy = '127.0.0.1:%d,127.0.0.1:%d'," % tuple(backends) +
+              " proxy_hot_replicas = 1, proxy_hot_threshold = 10 }")
+mc = MemcachedBinaryConnection("127.0.0.1", port)
+
+cas = mc.set('hot', 'value-1', flags=7)[0]['cas']
+for i in xrange(100):
+    res = mc.get('hot')[0]
+    iequal(res.get('val', None), 'value-1')
+    iequal(res.get('flags', None), 7)
+    # copies return CAS of the owner
+    iequal(res.get('cas', None), cas)
+stat = mc.stat()
+iequal(int(stat['proxy_hot_copies']) > 0, True)
+iequal(int(stat['proxy_hot_reads']) > 0, True)
+
+# cas of the value, read from a copy, is accepted by the owner
+res = mc.get('hot')[0]
+iequal(mc.set('hot', 'value-1', flags=7, cas=res['cas'])[0]['status'],
+       STATUS['SUCCESS'])
+
+# write deletes copies
+mc.set('hot', 'value-2', flags=7)
+for i in xrange(10):
+    iequal(mc.get('hot')[0].get('val', None), 'value-2')
+mc.delete('hot')
+for i in xrange(10):
+    iequal(mc.get('hot')[0]['status'], STATUS['KEY_ENOENT'])
+
+print("""#----------------------# router sheds, but doesn't store #---------------------#""")
+
+port = create('router4', "{ proxy = '127.0.0.1:%d,127.0.0.1:%d'," % tuple(backends) +
+              " shed_lag = 0.5, coalesce_window = 1 }")
+iequal(fibers('router4'), ['__mc_router4_lag'])
+mc = MemcachedBinaryConnection("127.0.0.1", port)
+iequal('loop_lag_usec' in mc.stat(), True)
+
+print("""#------------------------# unavailable backend fails #------------------------#""")
+
+port = create('router2', "{ proxy = '127.0.0.1:%d,127.0.0.1:1' }" % backends[0])
+mc = MemcachedBinaryConnection("127.0.0.1", port)
+
+errors = 0
+for i in xrange(20):
+    res = mc.set('key-%d' % i, 'value-%d' % i)[0]
+    if res['status'] == STATUS['SERVER_ERROR']:
+        errors += 1
+iequal(errors > 0, True)
+iequal(errors < 20, True)
+iequal(int(mc.stat()['proxy_errors']), errors)
+
+sys.path = saved_path
@@ -0,0 +1,57 @@
+import os
+import sys
+import yaml
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_connection import MemcachedBinaryConnection
+from internal.memcached_connection import STATUS, COMMANDS
+
+def iequal(left, right, level = 1):
+    if (left != right):
+        tb = traceback.extract_stack()[-(level + 1)]
+        print "Error on line %s:%d: %s not equal %s" % (tb[0], tb[1],
+                repr(left), repr(right))
+        return False
+    return True
+
+def admin(cmd):
+    return yaml.load(server.admin(cmd, silent=True))[0]
+
+admin("vb = require('memcached').create('vb', '127.0.0.1:0', { vbuckets = 4 })")
+port = admin("vb.listener:name().port")
+
+mc = MemcachedBinaryConnection("127.0.0.1", port)
+
+print("""#------------------------# items are counted by vbucket #------------------------#""")
+
+for i in xrange(20):
+    mc.set('key-%d' % i, 'value-%d' % i)
+
+stat = mc.stat('vbucket')
+iequal(sorted(stat.keys()), ['vb_0', 'vb_1', 'vb_2', 'vb_3'])
+total = 0
+for vb in xrange(4):
+    state, items = stat['vb_%d' % vb].split(' ')
+    iequal(state, 'active')
+    total += int(items.split('=')[1])
+iequal(total, 20)
+
+print("""#------------------------# dead vbucket is rejected #------------------------#""")
+
+vb = admin("vb:vbucket_of('key-1')")
+admin("vb:vbucket(%d, 'dead')" % vb)
+iequal(admin("vb:vbucket(%d)" % vb), 'dead')
+
+iequal(mc.get('key-1')[0]['status'], STATUS['VBUCKET_BADVAL'])
+iequal(mc.set('key-1', 'new')[0]['status'], STATUS['VBUCKET_BADVAL'])
+iequal(mc.stat('vbucket')['vb_%d' % vb].split(' ')[0], 'dead')
+iequal(int(mc.stat()['vbucket_rejects']), 2)
+
+admin("vb:vbucket(%d, 'active')" % vb)
+iequal(mc.get('key-1')[0]['val'], 'value-1')
+
+sys.path = saved_path
@@ -279,4 +279,22 @@ mc.prependq(key, prefix, nosend=True)
 check_empty_response(mc)
 check(key, 19, prefix + value)
 
+print("""#--------------------------# set of the same value #--------------------------#""")
+stat1 = mc.stat()
+# small values are set without reading the stored one
+key, value = "samekey", "same value" * 64
+res1 = mc.set(key, value, 0, 1)
+res2 = mc.set(key, value, 0, 2)
+iequal(res2[0]['status'], STATUS['SUCCESS'])
+iequal(res1[0]['cas'] != res2[0]['cas'], True)
+check(key, 2, value)
+iequal(mc.get(key)[0]['cas'], res2[0]['cas'])
+mc.set(key, value + " changed", 0, 2)
+check(key, 2, value + " changed")
+mc.set("smallkey", "small", 0, 1)
+mc.set("smallkey", "small", 0, 1)
+check("smallkey", 1, "small")
+stat2 = mc.stat()
+iequal(int(stat1['set_unchanged']) + 1, int(stat2['set_unchanged']))
+
 sys.path = saved_path
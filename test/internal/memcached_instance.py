@@ -0,0 +1,24 @@
+import yaml
+
+from internal.memcached_connection import MemcachedTextConnection
+
+# Tests, that check options of an instance, create their own instance on
+# a free port through the admin console of the suite's server.
+
+def admin(server, cmd):
+    resp = server.admin(cmd, silent=True)
+    return yaml.load(resp)[0]
+
+def create(server, name, opts = '{}'):
+    """Create instance, that is kept in Lua variable 'name' of the admin
+    console, and return text connection to it"""
+    admin(server, "%s = require('memcached').create('%s', '127.0.0.1:0', %s)" %
+          (name, name, opts))
+    port = admin(server, "%s.listener:name().port" % name)
+    return MemcachedTextConnection('localhost', port)
+
+def stat(mc, name):
+    resp = mc("stats\r\n", silent=True)
+    for line in resp.split('\r\n'):
+        if line.startswith('STAT %s ' % name):
+            return line.split(' ')[2]
@@ -0,0 +1,50 @@
+import os
+import sys
+import time
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin, stat
+
+mc_client = create(server, 'adm',
+                   "{ protocol = 'text', admission = 'not_stored', " +
+                   "tenants = { a = { prefix = 'a:', quota = 2000 } } }")
+
+value = 'x' * 100
+print """# working set is read often """
+for i in xrange(10):
+    mc_client("set a:hot-%d 0 0 %d\r\n%s\r\n" % (i, len(value), value),
+              silent=True)
+for _ in xrange(5):
+    for i in xrange(10):
+        mc_client("get a:hot-%d\r\n" % i, silent=True)
+
+print """# bulk load of new keys doesn't evict it """
+replies = []
+for i in xrange(20):
+    replies.append(mc_client("set a:cold-%d 0 0 %d\r\n%s\r\n" %
+                             (i, len(value), value), silent=True))
+print "stored: %s" % ('STORED\r\n' in replies)
+print "rejected: %s" % ('NOT_STORED\r\n' in replies)
+print "hot kept: %s" % admin(server, "local n = 0 for i = 0, 9 do " +
+    "if box.space.__mc_adm_a:get('a:hot-' .. i) then n = n + 1 end " +
+    "end return n")
+rejected = int(stat(mc_client, 'admission_rejected'))
+print "admission_rejected: %s" % (rejected > 0)
+
+print """# update of stored key is admitted """
+mc_client("set a:hot-0 0 0 3\r\nnew\r\n")
+
+print """# request counts access of its key once """
+accesses = int(stat(mc_client, 'admission_accesses'))
+mc_client("set once 0 0 3\r\nnew\r\n", silent=True)
+large = 'y' * 600
+mc_client("set once 0 0 %d\r\n%s\r\n" % (len(large), large), silent=True)
+mc_client("add once 0 0 3\r\nnew\r\n", silent=True)
+mc_client("get once\r\n", silent=True)
+print "accesses: %d" % (int(stat(mc_client, 'admission_accesses')) - accesses)
+
+sys.path = saved_path
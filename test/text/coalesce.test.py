@@ -0,0 +1,42 @@
+import os
+import sys
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin, stat
+
+mc_client = create(server, 'coal',
+                   "{ coalesce_window = 3600, protocol = 'text' }")
+
+print """# only the last of sets is kept """
+for i in xrange(3):
+    mc_client("set counter 0 0 1\r\n%d\r\n" % i)
+mc_client("get counter\r\n")
+print "coalesced: %s" % stat(mc_client, 'set_coalesced')
+print "in space: %s" % admin(server,
+                             "box.space.__mc_coal:get('counter') ~= nil")
+
+print """# buffered sets are written on purge """
+admin(server, "coal:purge()")
+print "in space: %s" % admin(server, "box.space.__mc_coal:get('counter')[4]")
+
+print """# delete of buffered set """
+mc_client("set pending 0 0 5\r\nvalue\r\n")
+mc_client("delete pending\r\n")
+mc_client("get pending\r\n")
+
+print """# quiet sets are written by writer fibers """
+mc_client = create(server, 'async',
+                   "{ async_writers = 2, async_queue = 16, protocol = 'text' }")
+for i in xrange(100):
+    mc_client("set key-%d 0 0 %d noreply\r\nvalue-%d\r\n" %
+              (i, len('value-%d' % i), i), silent=True)
+mc_client("get key-99\r\n")
+admin(server, "async:purge()")
+print "in space: %s" % admin(server, "box.space.__mc_async:len()")
+print "errors: %s" % stat(mc_client, 'async_errors')
+
+sys.path = saved_path
@@ -0,0 +1,43 @@
+import os
+import sys
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_connection import MemcachedTextConnection
+from internal.memcached_instance import admin
+
+port = int(iproto.uri.split(':')[1])
+mc_client = MemcachedTextConnection('localhost', port)
+
+###################################
+def stats_dump():
+    resp = mc_client("stats dump\r\n", silent=True)
+    return sorted([line.split(' ')[1] for line in resp.split('\r\n')
+                   if line.startswith('STAT ')])
+###################################
+
+mc_client("set foo 0 0 6\r\nfooval\r\n")
+mc_client("set bar 42 0 6\r\nbarval\r\n")
+mc_client("set baz 0 1 6\r\nbazval\r\n")
+mc_client("delete baz\r\n")
+
+print """# stats dump lists every live item """
+print "keys: %s" % ', '.join(stats_dump())
+
+for fmt in ['binary', 'text']:
+    print """# export and import back in %s format """ % fmt
+    path = 'memcached.%s.dump' % fmt
+    print "exported: %d" % admin(server, "return require('memcached')" +
+        ".get('memcached'):export('%s', '%s')" % (path, fmt))
+    mc_client("flush_all\r\n")
+    mc_client("get foo bar\r\n")
+    print "imported: %d" % admin(server, "return require('memcached')" +
+        ".get('memcached'):import('%s', '%s')" % (path, fmt))
+    mc_client("get foo bar\r\n")
+
+mc_client("flush_all\r\n")
+
+sys.path = saved_path
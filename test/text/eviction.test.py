@@ -0,0 +1,29 @@
+import os
+import sys
+import time
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin, stat
+
+mc_client = create(server, 'ev',
+                   "{ protocol = 'text', eviction = 'gdsf', tenants = { " +
+                   "a = { prefix = 'a:', quota = 2000 } } }")
+
+value = 'x' * 100
+print """# item, that is expensive to recompute and read often """
+mc_client("set a:report %d 0 %d\r\n%s\r\n" % (200 << 24, len(value), value))
+for _ in xrange(10):
+    mc_client("get a:report\r\n", silent=True)
+
+print """# is kept, while cheap items are evicted """
+for i in xrange(100):
+    mc_client("set a:page-%d 0 0 %d\r\n%s\r\n" % (i, len(value), value),
+              silent=True)
+print "evicted: %s" % (int(stat(mc_client, 'tenant_evictions')) > 0)
+mc_client("get a:report\r\n")
+
+sys.path = saved_path
@@ -0,0 +1,40 @@
+import os
+import sys
+import time
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin, stat
+
+###################################
+
+def wait_for(cond, timeout = 10):
+    deadline = time.time() + timeout
+    while not cond() and time.time() < deadline:
+        time.sleep(0.05)
+    return cond()
+###################################
+
+# full scan takes longer, than a second per batch, the pause is capped
+mc_client = create(server, 'ea',
+                   "{ protocol = 'text', expire_items_per_iter = 10, " +
+                   "expire_full_scan_time = 3600 }")
+
+print """# configured pace """
+print "expire_pace: %s" % stat(mc_client, 'expire_pace')
+
+print """# expired items speed the scan up """
+for i in xrange(300):
+    mc_client("set key-%d 0 1 1\r\n%d\r\n" % (i, i % 10), silent=True)
+print "faster: %s" % wait_for(lambda: int(stat(mc_client, 'expire_pace')) > 100)
+print "expire_speedups: %s" % (int(stat(mc_client, 'expire_speedups')) > 0)
+print "expired: %s" % wait_for(lambda: admin(server,
+                                             "box.space.__mc_ea:len()") == 0)
+
+print """# and it returns to the configured pace """
+print "back: %s" % wait_for(lambda: int(stat(mc_client, 'expire_pace')) == 100)
+
+sys.path = saved_path
@@ -0,0 +1,28 @@
+import os
+import sys
+import time
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin, stat
+
+mc_client = create(server, 'es',
+                   "{ protocol = 'text', expire_strategy = 'sample', " +
+                   "expire_items_per_iter = 100 }")
+
+print """# expired items are found by random samples """
+for i in xrange(50):
+    mc_client("set key-%d 0 1 1\r\n%d\r\n" % (i, i % 10), silent=True)
+for i in xrange(10):
+    mc_client("set live-%d 0 0 1\r\n%d\r\n" % (i, i), silent=True)
+print "stored: %s" % admin(server, "box.space.__mc_es:len()")
+time.sleep(3)
+print "left: %s" % admin(server, "box.space.__mc_es:len()")
+print "evicted: %s" % stat(mc_client, 'evictions')
+print "sampled: %s" % (int(stat(mc_client, 'expire_sampled')) > 0)
+mc_client("get live-9\r\n")
+
+sys.path = saved_path
@@ -0,0 +1,28 @@
+import os
+import sys
+import time
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin, stat
+
+mc_client = create(server, 'ol',
+                   "{ protocol = 'text', shed_lag = 0.5, shed_delay = 0.5 }")
+
+print """# nothing is shed without overload """
+for i in xrange(100):
+    mc_client("set key-%d 0 0 1\r\n%d\r\n" % (i, i % 10), silent=True)
+mc_client("get key-99\r\n")
+print "stored: %s" % admin(server, "box.space.__mc_ol:len()")
+print "shed_busy: %s" % stat(mc_client, 'shed_busy')
+print "shed_dropped: %s" % stat(mc_client, 'shed_dropped')
+
+print """# lag monitor is stopped on the fly """
+admin(server, "ol:cfg{ shed_lag = 0 }")
+print "loop_lag_usec: %s" % stat(mc_client, 'loop_lag_usec')
+mc_client("get key-0\r\n")
+
+sys.path = saved_path
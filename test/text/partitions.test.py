@@ -0,0 +1,37 @@
+import os
+import sys
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin
+
+###################################
+def stats_partitions():
+    resp = mc_client("stats partitions\r\n", silent=True)
+    return [line.split(' ')[2] for line in resp.split('\r\n')
+            if line.startswith('STAT ')]
+###################################
+
+mc_client = create(server, 'parts', "{ partitions = 4, protocol = 'text' }")
+
+print """# every partition is stored in its own space """
+print "spaces: %s" % admin(server, "local names = {} " +
+    "for _, space in ipairs(parts.spaces) do table.insert(names, space.name) end " +
+    "return table.concat(names, ', ')")
+
+for i in xrange(20):
+    mc_client("set key-%d 0 0 %d\r\nvalue-%d\r\n" % (i, len('value-%d' % i), i),
+              silent=True)
+
+print "items: %s" % ', '.join(stats_partitions())
+mc_client("get key-1 key-2\r\n")
+
+print """# partition is flushed alone """
+admin(server, "parts:flush_partition(1)")
+print "items: %s" % ', '.join(stats_partitions())
+mc_client("get key-1 key-2\r\n")
+
+sys.path = saved_path
@@ -0,0 +1,40 @@
+import os
+import sys
+import time
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_connection import MemcachedTextConnection
+from internal.memcached_instance import create, admin, stat
+
+mc_client = create(server, 'pr', "{ protocol = 'text', priority = 'low' }")
+
+print """# low priority connection is served alone """
+for i in xrange(100):
+    mc_client("set key-%d 0 0 1\r\n%d\r\n" % (i, i % 10), silent=True)
+mc_client("get key-99\r\n")
+print "stored: %s" % admin(server, "box.space.__mc_pr:len()")
+print "priority_yields: %s" % stat(mc_client, 'priority_yields')
+
+print """# class is changed on the fly """
+admin(server, "pr:cfg{ priority = 'high' }")
+mc_client("get key-0\r\n")
+print "bad class: %s" % admin(server, "(pcall(pr.cfg, pr, " +
+                                      "{ priority = 'top' }))")
+print "bad user class: %s" % admin(server, "(pcall(pr.cfg, pr, { " +
+    "user_priority = { guest = 'top' } }))")
+print "priority: %s" % admin(server, "pr.opts.priority")
+
+print """# partly read request of high priority doesn't hold others """
+idle = MemcachedTextConnection('localhost',
+                               admin(server, "pr.listener:name().port"))
+idle.socket.sendall("get key-")
+mc_client = create(server, 'prl', "{ protocol = 'text', priority = 'low' }")
+for i in xrange(10):
+    mc_client("get key-%d\r\n" % i, silent=True)
+print "priority_yields: %s" % stat(mc_client, 'priority_yields')
+
+sys.path = saved_path
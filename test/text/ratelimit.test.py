@@ -0,0 +1,31 @@
+import os
+import sys
+import time
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin, stat
+
+mc_client = create(server, 'rl', "{ protocol = 'text', conn_ops_limit = 50 }")
+
+print """# connection over its rate is delayed, not rejected """
+start = time.time()
+for i in xrange(100):
+    mc_client("set key-%d 0 0 1\r\n%d\r\n" % (i, i % 10), silent=True)
+elapsed = time.time() - start
+mc_client("get key-99\r\n")
+print "delayed: %s" % (elapsed > 0.5)
+print "throttled: %s" % (int(stat(mc_client, 'throttled')) > 0)
+print "stored: %s" % admin(server, "box.space.__mc_rl:len()")
+
+print """# limit is changed on the fly """
+admin(server, "rl:cfg{ conn_ops_limit = 0 }")
+before = int(stat(mc_client, 'throttled'))
+for i in xrange(100):
+    mc_client("get key-%d\r\n" % i, silent=True)
+print "throttled more: %s" % (int(stat(mc_client, 'throttled')) > before)
+
+sys.path = saved_path
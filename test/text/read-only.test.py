@@ -0,0 +1,53 @@
+import os
+import sys
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_connection import MemcachedTextConnection
+
+port = int(iproto.uri.split(':')[1])
+mc_client = MemcachedTextConnection('localhost', port)
+
+def read_only(flag):
+    server.admin("require('memcached').get('memcached'):cfg{ read_only = %s," % flag +
+                 " master = '127.0.0.1:11211' }", silent=True)
+
+mc_client("set foo 0 0 6\r\nfooval\r\n")
+
+print """# writes are rejected by read only instance """
+read_only('true')
+mc_client("get foo\r\n")
+mc_client("set foo 0 0 6\r\nnewval\r\n")
+mc_client("incr foo 1\r\n")
+mc_client("delete foo\r\n")
+mc_client("flush_all\r\n")
+mc_client("get foo\r\n")
+
+print """# and accepted again, when it's promoted """
+read_only('false')
+mc_client("set foo 0 0 6\r\nnewval\r\n")
+mc_client("get foo\r\n")
+
+mc_client("flush_all\r\n")
+
+print """# background fibers start with the instance, not on cfg """
+server.admin("ro = require('memcached').create('ro', '127.0.0.1:0', " +
+             "{ read_only = false, shed_lag = 1 })", silent=True)
+server.admin("function ro_fibers() local names = {} " +
+             "for _, f in pairs(require('fiber').info()) do " +
+             "if f.name:find('^__mc_ro_') then table.insert(names, f.name) " +
+             "end end table.sort(names) return names end", silent=True)
+server.admin("ro_fibers()")
+server.admin("ro:stop()", silent=True)
+server.admin("ro_fibers()")
+server.admin("ro:cfg{ coalesce_window = 1, async_writers = 2 }",
+             silent=True)
+server.admin("ro_fibers()")
+server.admin("ro:start()", silent=True)
+server.admin("ro_fibers()")
+server.admin("ro:stop()", silent=True)
+
+sys.path = saved_path
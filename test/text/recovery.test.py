@@ -0,0 +1,64 @@
+import os
+import sys
+import time
+import shutil
+import inspect
+import tempfile
+import traceback
+import subprocess
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import admin
+
+# xlogs are written and replayed by a separate tarantool, main server
+# of the suite runs without WAL
+script = """
+local memcached = require('memcached')
+local fiber = require('fiber')
+local phase, dir = arg[1], arg[2]
+if phase == 'replay' then
+    memcached.skip_expired_on_recovery()
+end
+box.cfg{ work_dir = dir, log = 'tarantool.log' }
+if phase == 'write' then
+    memcached.create('rec', '127.0.0.1:0', { expire_enabled = false })
+    local space = box.space.__mc_rec
+    local now = fiber.time64()
+    space:replace{ 'live', now + 3600000000ULL, now, 'live', 1ULL, 0 }
+    space:replace{ 'key', now + 3600000000ULL, now, 'old', 2ULL, 0 }
+    space:replace{ 'key', now + 500000ULL, now, 'new', 3ULL, 0 }
+else
+    local space = box.space.__mc_rec
+    print(space:get('live') ~= nil, space:get('key') == nil)
+end
+os.exit(0)
+"""
+
+binary = admin(server, "arg[-1]")
+cwd = admin(server, "require('fio').cwd()")
+env = dict(os.environ)
+env['LUA_PATH'] = admin(server, "package.path")
+env['LUA_CPATH'] = admin(server, "package.cpath")
+
+workdir = tempfile.mkdtemp(prefix='mc-recovery-')
+path = os.path.join(workdir, 'recovery.lua')
+with open(path, 'w') as f:
+    f.write(script)
+
+def run(phase):
+    out = subprocess.check_output([binary, path, phase, workdir],
+                                  cwd=cwd, env=env)
+    return out.strip()
+
+print """# older value is live, newer one expires before replay """
+run('write')
+time.sleep(1)
+
+print """# replay drops the key, not brings back the old value """
+print run('replay')
+
+shutil.rmtree(workdir)
+
+sys.path = saved_path
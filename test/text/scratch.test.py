@@ -0,0 +1,34 @@
+import os
+import sys
+import time
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin, stat
+
+mc_client = create(server, 'scr', "{ protocol = 'text' }")
+
+for i in xrange(100):
+    mc_client("set key-%d 0 0 1\r\n%d\r\n" % (i, i % 10), silent=True)
+
+print """# multiget doesn't allocate scratch memory """
+before = int(stat(mc_client, 'scratch_bytes'))
+keys = ' '.join('key-%d' % i for i in xrange(100))
+for _ in xrange(10):
+    mc_client("get %s\r\n" % keys, silent=True)
+mc_client("get key-99\r\n")
+after = int(stat(mc_client, 'scratch_bytes'))
+print "scratch_bytes same: %s" % (after == before)
+
+print """# append builds the new value in scratch memory """
+value = 'x' * 1000
+print "append: %s" % mc_client("append key-0 0 0 %d\r\n%s\r\n" %
+                               (len(value), value), silent=True).strip()
+print "scratch_bytes grown: %s" % (int(stat(mc_client, 'scratch_bytes')) >=
+                                   before + len(value))
+print "scratch_peak: %s" % (int(stat(mc_client, 'scratch_peak')) >= len(value))
+
+sys.path = saved_path
@@ -0,0 +1,63 @@
+import os
+import sys
+import time
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin, stat
+
+mc_client = create(server, 'inp', "{ protocol = 'text' }")
+
+print """# pipelined sets keep requests, that follow, intact """
+batch = ''.join("set key-%d %d 0 %d\r\n%s\r\n" % (i, i, 10 + i, 'v' * (10 + i))
+                for i in xrange(50))
+mc_client(batch, silent=True)
+ok = True
+for i in xrange(50):
+    resp = mc_client("get key-%d\r\n" % i, silent=True)
+    if resp != "VALUE key-%d %d %d\r\n%s\r\nEND\r\n" % (i, i, 10 + i,
+                                                       'v' * (10 + i)):
+        ok = False
+print "values: %s" % ok
+print "set_inplace: %s" % (int(stat(mc_client, 'set_inplace')) > 0)
+mc_client("get key-0\r\n")
+
+print """# long fields between key and value don't corrupt the key """
+ok = True
+for klen in xrange(1, 41):
+    key = ''.join(chr(ord('a') + i % 26) for i in xrange(klen))
+    for fields in ['4294967295 2592000 5 noreply', '4294967295 0 5 noreply',
+                   '4294967295 2592000 5']:
+        mc_client("set %s %s\r\nvalue\r\n" % (key, fields), silent=True)
+        resp = mc_client("get %s\r\n" % key, silent=True)
+        if resp != "VALUE %s 4294967295 5\r\nvalue\r\nEND\r\n" % key:
+            ok = False
+        mc_client("delete %s\r\n" % key, silent=True)
+print "keys: %s" % ok
+mc_client("set abcdefghijklmnop 4294967295 2592000 5 noreply\r\nvalue\r\n")
+mc_client("get abcdefghijklmnop\r\n")
+
+print """# sets, dropped by admission, aren't counted """
+mc_client = create(server, 'inpa',
+                   "{ protocol = 'text', admission = 'accept', tenants = { " +
+                   "a = { prefix = 'a:', quota = 2000 } } }")
+value = 'x' * 100
+for i in xrange(10):
+    mc_client("set a:hot-%d 0 0 %d\r\n%s\r\n" % (i, len(value), value),
+              silent=True)
+for _ in xrange(5):
+    for i in xrange(10):
+        mc_client("get a:hot-%d\r\n" % i, silent=True)
+inplace = int(stat(mc_client, 'set_inplace'))
+rejected = int(stat(mc_client, 'admission_rejected'))
+mc_client(''.join("set a:cold-%d 0 0 %d\r\n%s\r\n" % (i, len(value), value)
+                  for i in xrange(20)), silent=True)
+inplace = int(stat(mc_client, 'set_inplace')) - inplace
+rejected = int(stat(mc_client, 'admission_rejected')) - rejected
+print "rejected: %s" % (rejected > 0)
+print "set_inplace of stored: %s" % (inplace <= 20 - rejected)
+
+sys.path = saved_path
@@ -0,0 +1,26 @@
+import os
+import sys
+import time
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin, stat
+
+mc_client = create(server, 'sl', "{ protocol = 'text', sliding_flag = 256 }")
+
+print """# session lives for TTL since the last read """
+mc_client("set session 256 3 2\r\nok\r\n")
+mc_client("set fixed 0 3 2\r\nok\r\n")
+time.sleep(2)
+mc_client("get session fixed\r\n", silent=True)
+wal = admin(server, "box.space.__mc_sl:get('session')[3]")
+time.sleep(1.5)
+mc_client("get session fixed\r\n")
+print "tuple not written: %s" % (admin(server,
+                                 "box.space.__mc_sl:get('session')[3]") == wal)
+print "sliding_touches: %s" % stat(mc_client, 'sliding_touches')
+
+sys.path = saved_path
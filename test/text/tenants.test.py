@@ -0,0 +1,69 @@
+import os
+import sys
+import inspect
+import traceback
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin
+
+###################################
+def stats_tenants():
+    resp = mc_client("stats tenants\r\n", silent=True)
+    tenants = {}
+    for line in resp.split('\r\n'):
+        if not line.startswith('STAT '):
+            continue
+        name, value = line.split(' ', 2)[1:]
+        tenants[name] = dict(kv.split('=') for kv in value.split(' '))
+    return tenants
+###################################
+
+mc_client = create(server, 'ten',
+                   "{ protocol = 'text', tenants = { " +
+                   "a = { prefix = 'a:', quota = 2000 }, " +
+                   "b = { prefix = 'b:' } } }")
+
+print """# every tenant is stored in its own space """
+print "spaces: %s" % admin(server, "local names = {} " +
+    "for _, space in ipairs(ten.spaces) do table.insert(names, space.name) end " +
+    "return table.concat(names, ', ')")
+
+value = 'x' * 100
+for i in xrange(50):
+    mc_client("set a:%d 0 0 %d\r\n%s\r\n" % (i, len(value), value), silent=True)
+    mc_client("set b:%d 0 0 %d\r\n%s\r\n" % (i, len(value), value), silent=True)
+mc_client("set c:0 0 0 %d\r\n%s\r\n" % (len(value), value), silent=True)
+
+print """# tenant with quota is kept within it """
+stat = stats_tenants()
+print "tenants: %s" % sorted(stat.keys())
+print "a within quota: %s" % (int(stat['tenant_a']['bytes']) <= 2000)
+print "a evicted: %s" % (int(stat['tenant_a']['evictions']) > 0)
+print "a items: %s" % admin(server, "box.space.__mc_ten_a:len() == " +
+                                    "%s" % stat['tenant_a']['items'])
+print "b items: %s" % stat['tenant_b']['items']
+print "others: %s" % admin(server, "box.space.__mc_ten:len()")
+
+print """# hit rate of tenant """
+mc_client("get b:1\r\n")
+mc_client("get b:missing\r\n")
+stat = stats_tenants()
+print "b hits: %s, misses: %s" % (stat['tenant_b']['get_hits'],
+                                  stat['tenant_b']['get_misses'])
+
+print """# add of stored key to full tenant evicts nothing """
+key = admin(server, "box.space.__mc_ten_a:select({}, { limit = 1 })[1][1]")
+evictions = stats_tenants()['tenant_a']['evictions']
+print "add: %s" % mc_client("add %s 0 0 %d\r\n%s\r\n" %
+                            (key, len(value), value), silent=True).strip()
+print "evicted: %s" % (stats_tenants()['tenant_a']['evictions'] != evictions)
+
+print """# tenants can't be changed after creation """
+print "same: %s" % admin(server, "(pcall(ten.cfg, ten, { tenants = { " +
+    "a = { prefix = 'a:', quota = 2000 }, b = { prefix = 'b:' } } }))")
+print "changed: %s" % admin(server, "select(2, pcall(ten.cfg, ten, { " +
+    "tenants = { a = { prefix = 'a:' } } })):match('Option.*')")
+
+sys.path = saved_path
@@ -0,0 +1,96 @@
+import os
+import sys
+import time
+import shutil
+import socket
+import inspect
+import tempfile
+import traceback
+import subprocess
+
+saved_path = sys.path[:]
+sys.path.append(os.path.dirname(os.path.abspath(inspect.getsourcefile(lambda:0))))
+
+from internal.memcached_instance import create, admin
+from internal.memcached_connection import MemcachedTextConnection
+
+# Source node is a separate tarantool, main server of the suite is the
+# warming node
+script = """
+local memcached = require('memcached')
+local listen, dir = arg[1], arg[2]
+box.cfg{ listen = listen, work_dir = dir, wal_mode = 'none',
+         log = 'tarantool.log' }
+box.schema.user.grant('guest', 'read,write,execute', 'universe')
+local inst = memcached.create('warm', '127.0.0.1:0', {
+    protocol = 'text', expire_enabled = false
+})
+print(inst.listener:name().port)
+io.stdout:flush()
+"""
+
+def free_port():
+    sock = socket.socket()
+    sock.bind(('127.0.0.1', 0))
+    port = sock.getsockname()[1]
+    sock.close()
+    return port
+
+def wait(cond):
+    for _ in xrange(100):
+        if cond():
+            return True
+        time.sleep(0.05)
+    return False
+
+binary = admin(server, "arg[-1]")
+cwd = admin(server, "require('fio').cwd()")
+env = dict(os.environ)
+env['LUA_PATH'] = admin(server, "package.path")
+env['LUA_CPATH'] = admin(server, "package.cpath")
+
+workdir = tempfile.mkdtemp(prefix='mc-warmup-')
+path = os.path.join(workdir, 'source.lua')
+with open(path, 'w') as f:
+    f.write(script)
+
+source_uri = '127.0.0.1:%d' % free_port()
+source = subprocess.Popen([binary, path, source_uri, workdir],
+                          cwd=cwd, env=env, stdout=subprocess.PIPE)
+src = MemcachedTextConnection('localhost', int(source.stdout.readline()))
+
+keys = ['key-%d' % i for i in xrange(5)]
+
+print """# source has live items and an expired one """
+for key in keys:
+    src("set %s 0 0 3\r\nold\r\n" % key, silent=True)
+src("set dead 0 1 4\r\ndead\r\n")
+time.sleep(2)
+
+mc = create(server, 'warm',
+            "{ protocol = 'text', expire_enabled = false }")
+admin(server, "warmup_total = nil")
+admin(server, "require('fiber').create(function() " +
+              "warmup_total = warm:warmup('%s', { page = 1, delay = 0.1 }) " %
+              source_uri + "end)")
+
+print """# keys are updated on source after the first page is copied """
+print "copying: %s" % wait(lambda: admin(server, "warm.spaces[1]:len()") > 0)
+for key in keys:
+    src("set %s 0 0 3\r\nnew\r\n" % key, silent=True)
+
+print "done: %s" % wait(lambda: admin(server, "warmup_total") is not None)
+
+print """# only live items are copied """
+print "items: %d" % admin(server, "warm.spaces[1]:len()")
+mc("get dead\r\n")
+
+print """# catch-up passes bring updates, made during warmup """
+for key in keys:
+    mc("get %s\r\n" % key)
+
+source.terminate()
+source.wait()
+shutil.rmtree(workdir)
+
+sys.path = saved_path